@@ -4,6 +4,42 @@
 #include <cmath>
 #include <algorithm>
 #include <map>
+#include <memory>
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <limits>
+#include <cstdint>
+#include <fstream>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <filesystem>
+#include <list>
+#include <deque>
+#include <csignal>
+#include <cerrno>
+#include <cstdio>
+#include <charconv>
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
@@ -72,6 +108,52 @@ struct Mat4
         return result;
     }
 
+    // General inverse by cofactor expansion; a singular matrix yields the
+    // identity.
+    static Mat4 inverse(const Mat4 &a)
+    {
+        const float *m = a.m;
+        Mat4 inv;
+        inv.m[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] +
+                   m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+        inv.m[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - m[8] * m[7] * m[14] -
+                   m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+        inv.m[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + m[8] * m[7] * m[13] +
+                   m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+        inv.m[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - m[8] * m[6] * m[13] -
+                    m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+        inv.m[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - m[9] * m[3] * m[14] -
+                   m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+        inv.m[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + m[8] * m[3] * m[14] +
+                   m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+        inv.m[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - m[8] * m[3] * m[13] -
+                   m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+        inv.m[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + m[8] * m[2] * m[13] +
+                    m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+        inv.m[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] + m[5] * m[3] * m[14] +
+                   m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+        inv.m[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] - m[4] * m[3] * m[14] -
+                   m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+        inv.m[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] + m[4] * m[3] * m[13] +
+                    m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+        inv.m[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] - m[4] * m[2] * m[13] -
+                    m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+        inv.m[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] - m[5] * m[3] * m[10] -
+                   m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+        inv.m[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] + m[4] * m[3] * m[10] +
+                   m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+        inv.m[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] - m[4] * m[3] * m[9] -
+                    m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+        inv.m[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] + m[4] * m[2] * m[9] +
+                    m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+        float det = m[0] * inv.m[0] + m[1] * inv.m[4] + m[2] * inv.m[8] + m[3] * inv.m[12];
+        if (det == 0.0f)
+            return identity();
+        for (float &v : inv.m)
+            v /= det;
+        return inv;
+    }
+
     Vec4 transform(const Vec4 &v) const
     {
         Vec4 result;
@@ -137,265 +219,6181 @@ struct Mat4
     }
 };
 
+// --- Allocation Tracking ---
+
+#if !defined(NDEBUG) && defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+// Debug builds count heap allocations so the frame loop can assert that
+// steady-state frames never touch the heap. glibc lets a program supply
+// its own malloc; these count and forward to glibc's, which operator new
+// reaches too, so the allocator itself is unchanged. Only threads inside
+// an AllocationTracking scope count, which keeps SDL and the GPU driver,
+// called from the same frame loop, out of the total.
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *p, size_t size);
+extern "C" void *__libc_memalign(size_t alignment, size_t size);
+
+static std::atomic<size_t> g_heap_allocations{0};
+static thread_local int t_allocation_tracking = 0;
+
+static void count_allocation()
+{
+    if (t_allocation_tracking > 0)
+        g_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C" void *malloc(size_t size) noexcept
+{
+    count_allocation();
+    return __libc_malloc(size);
+}
+extern "C" void *calloc(size_t count, size_t size) noexcept
+{
+    count_allocation();
+    return __libc_calloc(count, size);
+}
+extern "C" void *realloc(void *p, size_t size) noexcept
+{
+    count_allocation();
+    return __libc_realloc(p, size);
+}
+extern "C" void *memalign(size_t alignment, size_t size) noexcept
+{
+    count_allocation();
+    return __libc_memalign(alignment, size);
+}
+extern "C" void *aligned_alloc(size_t alignment, size_t size) noexcept
+{
+    count_allocation();
+    return __libc_memalign(alignment, size);
+}
+extern "C" int posix_memalign(void **p, size_t alignment, size_t size) noexcept
+{
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    count_allocation();
+    void *result = __libc_memalign(alignment, size);
+    if (!result)
+        return ENOMEM;
+    *p = result;
+    return 0;
+}
+
+struct AllocationTracking
+{
+    AllocationTracking() { ++t_allocation_tracking; }
+    ~AllocationTracking() { --t_allocation_tracking; }
+    AllocationTracking(const AllocationTracking &) = delete;
+    AllocationTracking &operator=(const AllocationTracking &) = delete;
+};
+
+size_t heap_allocation_count() { return g_heap_allocations.load(std::memory_order_relaxed); }
+#else
+struct AllocationTracking
+{
+};
+
+size_t heap_allocation_count() { return 0; }
+#endif
+
+// --- Frame Arena ---
+
+// Bump allocator for transient per-frame data. Everything carved from it is
+// released at once by reset(). If a frame outgrows the current block an
+// overflow block is chained on, and the next reset() folds the total into a
+// single block so subsequent frames of the same size never allocate.
+class FrameArena
+{
+public:
+    explicit FrameArena(size_t initial_capacity = 1 << 20) { add_block(initial_capacity); }
+
+    template <typename T>
+    T *alloc(size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "arena memory is never destructed");
+        size_t bytes = sizeof(T) * count;
+        size_t offset = (used + alignof(T) - 1) & ~(alignof(T) - 1);
+        if (offset + bytes > blocks.back().size)
+        {
+            add_block(std::max(bytes + alignof(T), blocks.back().size * 2));
+            offset = 0;
+        }
+        used = offset + bytes;
+        requested += bytes + alignof(T);
+        return reinterpret_cast<T *>(blocks.back().data.get() + offset);
+    }
+
+    // O(1) in steady state; only consolidates after a frame that overflowed.
+    void reset()
+    {
+        if (blocks.size() > 1)
+        {
+            size_t total = 0;
+            for (const auto &b : blocks)
+                total += b.size;
+            blocks.clear();
+            add_block(std::max(total, requested));
+        }
+        used = 0;
+        requested = 0;
+    }
+
+    size_t capacity() const { return blocks.back().size; }
+    size_t block_allocations() const { return allocations; }
+
+private:
+    struct Block
+    {
+        std::unique_ptr<unsigned char[]> data;
+        size_t size;
+    };
+
+    void add_block(size_t size)
+    {
+        blocks.push_back({std::unique_ptr<unsigned char[]>(new unsigned char[size]), size});
+        ++allocations;
+        used = 0;
+    }
+
+    std::vector<Block> blocks;
+    size_t used = 0;
+    size_t requested = 0;
+    size_t allocations = 0;
+};
+
 // --- Helper Functions ---
 
-char get_ascii_char(float intensity)
+const char *const DEFAULT_RAMP = " .:-=+*#%@"; // Dark to light
+
+char get_ascii_char(float intensity, const std::string &ascii_chars)
 {
-    const std::string ascii_chars = " .:-=+*#%@"; // Dark to light
     int index = static_cast<int>(intensity * (ascii_chars.length() - 1));
     index = std::max(0, std::min(static_cast<int>(ascii_chars.length() - 1), index));
     return ascii_chars[index];
 }
 
-// Barycentric coordinates calculation
-Vec3 barycentric(const Vec3 &p, const Vec3 &a, const Vec3 &b, const Vec3 &c)
+// Cell colours are packed RGB565, two bytes per cell.
+uint16_t pack_rgb565(const Vec3 &rgb)
 {
-    Vec3 v0 = Vec3::subtract(b, a);
-    Vec3 v1 = Vec3::subtract(c, a);
-    Vec3 v2 = Vec3::subtract(p, a);
-    float d00 = Vec3::dot(v0, v0);
-    float d01 = Vec3::dot(v0, v1);
-    float d11 = Vec3::dot(v1, v1);
-    float d20 = Vec3::dot(v2, v0);
-    float d21 = Vec3::dot(v2, v1);
-    float denom = d00 * d11 - d01 * d01;
-    if (std::abs(denom) < 1e-5)
-        return {-1, -1, -1}; // Degenerate triangle
-    float v = (d11 * d20 - d01 * d21) / denom;
-    float w = (d00 * d21 - d01 * d20) / denom;
-    float u = 1.0f - v - w;
-    return {u, v, w};
+    auto channel = [](float v, int max) { return static_cast<int>(std::max(0.0f, std::min(1.0f, v)) * max + 0.5f); };
+    return static_cast<uint16_t>(channel(rgb.x, 31) << 11 | channel(rgb.y, 63) << 5 | channel(rgb.z, 31));
 }
 
-// --- Main Application ---
+// Expands to 8 bits per channel, replicating high bits into the low ones
+// so white stays 255.
+void unpack_rgb565(uint16_t color, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+    int r5 = color >> 11, g6 = (color >> 5) & 0x3F, b5 = color & 0x1F;
+    *r = static_cast<uint8_t>(r5 << 3 | r5 >> 2);
+    *g = static_cast<uint8_t>(g6 << 2 | g6 >> 4);
+    *b = static_cast<uint8_t>(b5 << 3 | b5 >> 2);
+}
 
-int main(int argc, char *argv[])
+uint32_t rgb565_to_argb(uint16_t color)
+{
+    uint8_t r, g, b;
+    unpack_rgb565(color, &r, &g, &b);
+    return 0xFF000000u | static_cast<uint32_t>(r) << 16 | static_cast<uint32_t>(g) << 8 | b;
+}
+
+// How exported text frames carry cell colours.
+enum class ColorMode
+{
+    None,
+    Ansi256,  // xterm 256-colour palette
+    TrueColor // 24-bit SGR
+};
+
+bool parse_color_mode(const std::string &name, ColorMode *mode)
+{
+    if (name == "none")
+        *mode = ColorMode::None;
+    else if (name == "256")
+        *mode = ColorMode::Ansi256;
+    else if (name == "truecolor")
+        *mode = ColorMode::TrueColor;
+    else
+        return false;
+    return true;
+}
+
+// Nearest xterm 256-colour index: the 24-step grey ramp for near-greys,
+// otherwise the 6x6x6 cube.
+int ansi256_index(uint16_t color)
 {
-    if (argc < 3)
+    uint8_t r, g, b;
+    unpack_rgb565(color, &r, &g, &b);
+    if (std::max({r, g, b}) - std::min({r, g, b}) < 12)
     {
-        std::cerr << "Usage: " << argv[0] << " <path_to_obj_file> <path_to_font_file>" << std::endl;
-        return 1;
+        int grey = (r + g + b) / 3;
+        if (grey < 8)
+            return 16;
+        if (grey > 238)
+            return 231;
+        return 232 + (grey - 8) / 10;
     }
-    std::string inputfile = argv[1];
-    std::string fontfile = argv[2];
+    auto level = [](int v) { return v < 48 ? 0 : v < 115 ? 1 : (v - 35) / 40; };
+    return 16 + 36 * level(r) + 6 * level(g) + level(b);
+}
 
-    // 1. Initialize SDL and SDL_ttf
-    if (SDL_Init(SDL_INIT_VIDEO) < 0)
+// Appends one row of cells, switching colour only where a visible cell's
+// colour differs from the last one emitted, so runs of a colour cost a
+// single escape sequence. Blank cells keep whatever colour is active.
+// escape introduces a control sequence in the output's encoding.
+void append_colored_row(std::string &out, const char *cells, const uint16_t *colors, int count, ColorMode mode,
+                        const char *escape)
+{
+    int active = -1;
+    char code[32];
+    for (int i = 0; i < count; ++i)
     {
-        std::cerr << "SDL could not initialize! SDL_Error: " << SDL_GetError() << std::endl;
-        return 1;
+        if (cells[i] != ' ')
+        {
+            int key = mode == ColorMode::Ansi256 ? ansi256_index(colors[i]) : colors[i];
+            if (key != active)
+            {
+                active = key;
+                if (mode == ColorMode::Ansi256)
+                    std::snprintf(code, sizeof(code), "38;5;%dm", key);
+                else
+                {
+                    uint8_t r, g, b;
+                    unpack_rgb565(colors[i], &r, &g, &b);
+                    std::snprintf(code, sizeof(code), "38;2;%d;%d;%dm", r, g, b);
+                }
+                out += escape;
+                out += code;
+            }
+        }
+        out.push_back(cells[i]);
     }
-    if (TTF_Init() == -1)
+    if (active != -1)
     {
-        std::cerr << "SDL_ttf could not initialize! TTF_Error: " << TTF_GetError() << std::endl;
-        SDL_Quit();
-        return 1;
+        out += escape;
+        out += "0m";
     }
+}
 
-    const int SCREEN_WIDTH = 160; // Width in characters
-    const int SCREEN_HEIGHT = 90; // Height in characters
-    const int FONT_SIZE = 12;     // Font point size
-    int font_width, font_height;
+// Parses a "WxH" size with both sides positive.
+bool parse_size(const std::string &text, int *w, int *h)
+{
+    int a = 0, b = 0;
+    char trailing;
+    if (std::sscanf(text.c_str(), "%dx%d%c", &a, &b, &trailing) != 2 || a <= 0 || b <= 0)
+        return false;
+    *w = a;
+    *h = b;
+    return true;
+}
 
-    TTF_Font *font = TTF_OpenFont(fontfile.c_str(), FONT_SIZE);
-    if (!font)
+// --- Textures ---
+
+// A texture's luminance as a chain of 8-bit mip levels, each a 2x2 box
+// filter of the one before. Texels are stored in TILE x TILE blocks, so the
+// few texels a cell samples, which cluster in texture space rather than
+// along rows, share cache lines.
+struct LuminanceTexture
+{
+    static const int TILE = 8;
+
+    struct Level
     {
-        std::cerr << "Failed to load font: " << TTF_GetError() << std::endl;
-        TTF_Quit();
-        SDL_Quit();
-        return 1;
+        int width, height;
+        int tiles_x;
+        std::vector<uint8_t> texels;
+
+        // Coordinates outside the level wrap around.
+        uint8_t at(int x, int y) const
+        {
+            x %= width;
+            y %= height;
+            x += x < 0 ? width : 0;
+            y += y < 0 ? height : 0;
+            return texels[((y / TILE) * tiles_x + x / TILE) * (TILE * TILE) + (y % TILE) * TILE + x % TILE];
+        }
+    };
+
+    std::vector<Level> levels;
+
+    // Builds every level down to 1x1 from row-major luminance.
+    void build(std::vector<uint8_t> rows, int width, int height)
+    {
+        levels.clear();
+        for (;;)
+        {
+            levels.push_back(tile(rows, width, height));
+            if (width == 1 && height == 1)
+                break;
+            int next_width = std::max(1, width / 2), next_height = std::max(1, height / 2);
+            std::vector<uint8_t> next(static_cast<size_t>(next_width) * next_height);
+            for (int y = 0; y < next_height; ++y)
+                for (int x = 0; x < next_width; ++x)
+                {
+                    int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+                    int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+                    int sum = rows[y0 * width + x0] + rows[y0 * width + x1] + rows[y1 * width + x0] +
+                              rows[y1 * width + x1];
+                    next[y * next_width + x] = static_cast<uint8_t>((sum + 2) / 4);
+                }
+            rows.swap(next);
+            width = next_width;
+            height = next_height;
+        }
     }
-    TTF_SizeText(font, " ", &font_width, &font_height); // Get character dimensions
 
-    const int PIXEL_WIDTH = SCREEN_WIDTH * font_width;
-    const int PIXEL_HEIGHT = SCREEN_HEIGHT * font_height;
+    // The level whose texels are closest to covering one cell each, for a
+    // footprint of texels_per_cell level-0 texels per cell.
+    const Level &level_for(float texels_per_cell) const
+    {
+        int level = texels_per_cell > 1.0f ? static_cast<int>(0.5f * std::log2(texels_per_cell) + 0.5f) : 0;
+        return levels[std::min(level, static_cast<int>(levels.size()) - 1)];
+    }
 
-    SDL_Window *window = SDL_CreateWindow("ASCII Renderer", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, PIXEL_WIDTH, PIXEL_HEIGHT, SDL_WINDOW_SHOWN);
-    SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-    if (!window || !renderer)
+private:
+    static Level tile(const std::vector<uint8_t> &rows, int width, int height)
     {
-        std::cerr << "Window or Renderer could not be created! SDL_Error: " << SDL_GetError() << std::endl;
-        TTF_CloseFont(font);
-        TTF_Quit();
-        SDL_Quit();
-        return 1;
+        Level level;
+        level.width = width;
+        level.height = height;
+        level.tiles_x = (width + TILE - 1) / TILE;
+        int tiles_y = (height + TILE - 1) / TILE;
+        level.texels.assign(static_cast<size_t>(level.tiles_x) * tiles_y * TILE * TILE, 0);
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x)
+                level.texels[((y / TILE) * level.tiles_x + x / TILE) * (TILE * TILE) + (y % TILE) * TILE + x % TILE] =
+                    rows[y * width + x];
+        return level;
     }
+};
 
-    // Pre-render ASCII characters to textures for performance
-    std::map<char, SDL_Texture *> char_texture_cache;
-    SDL_Color text_color = {255, 255, 255, 255}; // White
-    const std::string ascii_chars = " .:-=+*#%@";
-    for (char c : ascii_chars)
+// Reads a binary Netpbm image, P5 (greyscale) or P6 (RGB) with at most 8
+// bits per channel, as row-major luminance.
+bool load_netpbm_luminance(const std::string &path, std::vector<uint8_t> *rows, int *width, int *height,
+                           std::string *error)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
     {
-        std::string s(1, c);
-        SDL_Surface *text_surface = TTF_RenderText_Solid(font, s.c_str(), text_color);
-        if (text_surface)
+        *error = "cannot open " + path;
+        return false;
+    }
+    // Header fields are whitespace-separated and may be interleaved with
+    // comments running to the end of the line.
+    auto field = [&](int *value) {
+        in >> std::ws;
+        while (in.peek() == '#')
         {
-            char_texture_cache[c] = SDL_CreateTextureFromSurface(renderer, text_surface);
-            SDL_FreeSurface(text_surface);
+            in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            in >> std::ws;
         }
+        return static_cast<bool>(in >> *value);
+    };
+    char magic[2] = {};
+    int max_value = 0;
+    in.read(magic, 2);
+    bool rgb = magic[0] == 'P' && magic[1] == '6';
+    if (!(magic[0] == 'P' && (magic[1] == '5' || rgb)) || !field(width) || !field(height) || !field(&max_value) ||
+        *width <= 0 || *height <= 0 || max_value <= 0 || max_value > 255)
+    {
+        *error = path + " is not an 8-bit binary PGM or PPM";
+        return false;
     }
+    in.get(); // The single whitespace byte before the raster
 
-    // 2. Load OBJ Model
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string warn, err;
-
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, inputfile.c_str()))
+    int channels = rgb ? 3 : 1;
+    std::vector<uint8_t> raster(static_cast<size_t>(*width) * *height * channels);
+    if (!in.read(reinterpret_cast<char *>(raster.data()), raster.size()))
     {
-        std::cerr << "Failed to load OBJ: " << warn << err << std::endl;
-        return 1;
+        *error = path + " is truncated";
+        return false;
+    }
+    rows->resize(static_cast<size_t>(*width) * *height);
+    for (size_t i = 0; i < rows->size(); ++i)
+    {
+        // Rec. 601 luma
+        int luma = rgb ? (299 * raster[3 * i] + 587 * raster[3 * i + 1] + 114 * raster[3 * i + 2] + 500) / 1000
+                       : raster[i];
+        (*rows)[i] = static_cast<uint8_t>(luma * 255 / max_value);
     }
+    return true;
+}
 
-    // 3. Main Loop
-    bool quit = false;
-    SDL_Event e;
-    float rotation_angle_y = 0.0f;
+// --- Mesh ---
 
-    std::vector<float> depth_buffer(SCREEN_WIDTH * SCREEN_HEIGHT, 0.0f);
-    std::vector<char> char_buffer(SCREEN_WIDTH * SCREEN_HEIGHT, ' ');
+// One level of detail: a triangle list over the model's shared positions and
+// an upper bound on how far (in model units) it strays from the original.
+struct MeshLod
+{
+    std::vector<uint32_t> indices;
+    std::vector<uint16_t> indices16; // Compact storage only; replaces indices for meshes of <= 65536 vertices
+    float error = 0.0f;
 
-    Vec3 camera_pos = {0.0f, 2.0f, -5.0f};
-    Vec3 look_at = {0.0f, 0.0f, 0.0f};
-    Vec3 up_vec = {0.0f, 1.0f, 0.0f};
-    Vec3 light_direction = Vec3::normalize({0.5f, -1.0f, -1.0f});
+    size_t index_count() const { return indices.size() + indices16.size(); }
+};
 
-    while (!quit)
+// A vertex in compact storage: a position quantized to 16 bits per axis
+// over its mesh's bounding box and an octahedral-encoded normal.
+struct QuantizedVertex
+{
+    uint16_t x, y, z;
+    uint16_t normal;
+};
+
+const float QUANTIZED_MAX = 65535.0f;
+
+// A shape from the OBJ file as a chain of progressively coarser LODs;
+// lods[0] is the original triangulation.
+struct Mesh
+{
+    std::vector<MeshLod> lods;
+    Vec3 center;
+    float radius = 0.0f;
+    Vec3 bounds_min, bounds_max;
+    uint16_t material = 0; // Index into Model::materials, shared by every triangle
+
+    // Compact storage (see quantize_model()): the mesh owns
+    // model.quantized[vertex_base, vertex_base + vertex_count) and its LOD
+    // indices are relative to vertex_base.
+    uint32_t vertex_base = 0;
+    uint32_t vertex_count = 0;
+    Vec3 quantization_step; // Model units per quantized step on each axis
+
+    Vec3 dequantize(const QuantizedVertex &q) const
     {
-        while (SDL_PollEvent(&e) != 0)
-        {
-            if (e.type == SDL_QUIT)
-                quit = true;
-        }
+        return {bounds_min.x + q.x * quantization_step.x, bounds_min.y + q.y * quantization_step.y,
+                bounds_min.z + q.z * quantization_step.z};
+    }
+
+    // dequantize() as a matrix, so it can be folded into the vertex transform.
+    Mat4 dequantize_matrix() const
+    {
+        Mat4 mat = Mat4::create_translation(bounds_min);
+        mat.m[0] = quantization_step.x;
+        mat.m[5] = quantization_step.y;
+        mat.m[10] = quantization_step.z;
+        return mat;
+    }
+};
 
-        std::fill(depth_buffer.begin(), depth_buffer.end(), 0.0f); // Init with 0 for 1/w
-        std::fill(char_buffer.begin(), char_buffer.end(), ' ');
+// Shading parameters of an MTL material, resolved at load time so that
+// rendering indexes them rather than looking materials up by name.
+struct Material
+{
+    Vec3 diffuse = {1.0f, 1.0f, 1.0f}; // Kd
+    Vec3 ambient = {0.0f, 0.0f, 0.0f}; // Ka
+    std::string ramp; // Non-standard "ascii_ramp" parameter; empty uses the renderer's ramp
+    int texture = -1; // Index into Model::textures, from map_Kd
+};
 
-        SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xFF);
-        SDL_RenderClear(renderer);
+struct TexCoord
+{
+    float u, v;
+};
 
-        // 4. Setup Matrices
-        Mat4 model_matrix = Mat4::create_rotation_y(rotation_angle_y);
-        rotation_angle_y += 0.01f;
-        Mat4 view_matrix = Mat4::lookAt(camera_pos, look_at, up_vec);
-        Mat4 projection_matrix = Mat4::perspective(90.0f, (float)PIXEL_WIDTH / PIXEL_HEIGHT, 0.1f, 100.0f);
+// Unique vertices shared by every mesh and LOD; normals[i] belongs to
+// positions[i] and is zero when the OBJ has none. A compact model keeps its
+// vertices in quantized instead and leaves positions and normals empty.
+// texcoords parallels whichever of the two is in use, and is empty when no
+// face has texture coordinates. Meshes are ordered by material.
+struct Model
+{
+    std::vector<Vec3> positions;
+    std::vector<Vec3> normals;
+    std::vector<QuantizedVertex> quantized;
+    std::vector<TexCoord> texcoords;
+    std::vector<Mesh> meshes;
+    std::vector<Material> materials; // materials[0] is the default, for faces without one
+    std::vector<LuminanceTexture> textures;
+    uint64_t id = 0; // Unique per build_model() call; renderers key their caches on it
+
+    bool compact() const { return !quantized.empty(); }
+    bool textured() const { return !texcoords.empty() && !textures.empty(); }
+};
+
+// Hash key for welding: the raw bits of a (position, normal, texcoord)
+// triple.
+struct VertexKey
+{
+    uint32_t bits[8];
+
+    bool operator==(const VertexKey &o) const { return std::memcmp(bits, o.bits, sizeof(bits)) == 0; }
+};
+
+struct VertexKeyHash
+{
+    size_t operator()(const VertexKey &k) const
+    {
+        uint64_t h = 1469598103934665603ull;
+        for (uint32_t b : k.bits)
+            h = (h ^ b) * 1099511628211ull;
+        return static_cast<size_t>(h);
+    }
+};
 
-        Mat4 mv_matrix = Mat4::multiply(view_matrix, model_matrix);
-        Mat4 mvp_matrix = Mat4::multiply(projection_matrix, mv_matrix);
+// Flattens tinyobj's output into one full-detail Mesh per shape and
+// material, so each triangle's material is its mesh's. tinyobj keeps
+// separate position, normal and texcoord indices; identical combinations
+// are welded into a single vertex so each corner is one index.
+Model build_model(const tinyobj::attrib_t &attrib, const std::vector<tinyobj::shape_t> &shapes,
+                  const std::vector<tinyobj::material_t> &materials)
+{
+    static std::atomic<uint64_t> next_id{1};
+    Model model;
+    model.id = next_id++;
+    size_t material_count = std::min<size_t>(materials.size(), std::numeric_limits<uint16_t>::max());
+    model.materials.resize(material_count + 1);
+    for (size_t m = 0; m < material_count; ++m)
+    {
+        const tinyobj::material_t &source = materials[m];
+        Material &material = model.materials[m + 1];
+        material.diffuse = {source.diffuse[0], source.diffuse[1], source.diffuse[2]};
+        material.ambient = {source.ambient[0], source.ambient[1], source.ambient[2]};
+        auto ramp = source.unknown_parameter.find("ascii_ramp");
+        if (ramp != source.unknown_parameter.end())
+            material.ramp = ramp->second;
+    }
 
-        // 5. Render Loop
-        for (const auto &shape : shapes)
+    std::unordered_map<VertexKey, uint32_t, VertexKeyHash> welded;
+    welded.reserve(attrib.vertices.size() / 3);
+    // Texture coordinates only split vertices when something can use them.
+    bool use_texcoords = std::any_of(materials.begin(), materials.end(),
+                                     [](const tinyobj::material_t &m) { return !m.diffuse_texname.empty(); });
+    bool any_texcoords = false;
+    auto weld = [&](const tinyobj::index_t &idx) {
+        Vec3 p = {attrib.vertices[3 * idx.vertex_index + 0], attrib.vertices[3 * idx.vertex_index + 1],
+                  attrib.vertices[3 * idx.vertex_index + 2]};
+        Vec3 n;
+        if (idx.normal_index >= 0)
+            n = {attrib.normals[3 * idx.normal_index + 0], attrib.normals[3 * idx.normal_index + 1],
+                 attrib.normals[3 * idx.normal_index + 2]};
+        TexCoord t = {0.0f, 0.0f};
+        if (use_texcoords && idx.texcoord_index >= 0)
         {
-            for (size_t f = 0; f < shape.mesh.num_face_vertices.size(); f++)
-            {
-                int fv = shape.mesh.num_face_vertices[f];
-                if (fv != 3)
-                    continue; // Only process triangles
+            t = {attrib.texcoords[2 * idx.texcoord_index + 0], attrib.texcoords[2 * idx.texcoord_index + 1]};
+            any_texcoords = true;
+        }
+        VertexKey key;
+        std::memcpy(&key.bits[0], &p, sizeof(Vec3));
+        std::memcpy(&key.bits[3], &n, sizeof(Vec3));
+        std::memcpy(&key.bits[6], &t, sizeof(TexCoord));
+        auto inserted = welded.emplace(key, static_cast<uint32_t>(model.positions.size()));
+        if (inserted.second)
+        {
+            model.positions.push_back(p);
+            model.normals.push_back(n);
+            model.texcoords.push_back(t);
+        }
+        return inserted.first->second;
+    };
 
-                tinyobj::index_t idx[3];
-                Vec3 v_world[3];
-                for (int i = 0; i < 3; ++i)
+    std::vector<int> shape_mesh(model.materials.size()); // Per material, this shape's mesh or -1
+    for (const auto &shape : shapes)
+    {
+        size_t first_mesh = model.meshes.size();
+        std::fill(shape_mesh.begin(), shape_mesh.end(), -1);
+        size_t index_offset = 0;
+        for (size_t f = 0; f < shape.mesh.num_face_vertices.size(); f++)
+        {
+            int fv = shape.mesh.num_face_vertices[f];
+            if (fv == 3) // Only process triangles
+            {
+                int id = f < shape.mesh.material_ids.size() ? shape.mesh.material_ids[f] : -1;
+                size_t material = id >= 0 && static_cast<size_t>(id) < material_count ? id + 1 : 0;
+                if (shape_mesh[material] < 0)
                 {
-                    idx[i] = shape.mesh.indices[f * 3 + i];
-                    v_world[i] = {
-                        attrib.vertices[3 * idx[i].vertex_index + 0],
-                        attrib.vertices[3 * idx[i].vertex_index + 1],
-                        attrib.vertices[3 * idx[i].vertex_index + 2]};
+                    shape_mesh[material] = static_cast<int>(model.meshes.size());
+                    model.meshes.emplace_back();
+                    model.meshes.back().lods.emplace_back();
+                    model.meshes.back().material = static_cast<uint16_t>(material);
                 }
+                std::vector<uint32_t> &indices = model.meshes[shape_mesh[material]].lods[0].indices;
+                for (int i = 0; i < 3; ++i)
+                    indices.push_back(weld(shape.mesh.indices[index_offset + i]));
+            }
+            index_offset += fv;
+        }
 
-                // Back-face culling
-                Vec3 edge1 = Vec3::subtract(v_world[1], v_world[0]);
-                Vec3 edge2 = Vec3::subtract(v_world[2], v_world[0]);
-                Vec3 face_normal = Vec3::normalize(Vec3::cross(edge1, edge2));
-                Vec3 view_vector = Vec3::normalize(Vec3::subtract(v_world[0], camera_pos));
-                if (Vec3::dot(face_normal, view_vector) >= 0)
-                    continue;
+        for (size_t m = first_mesh; m < model.meshes.size(); ++m)
+        {
+            Mesh &mesh = model.meshes[m];
+            const std::vector<uint32_t> &indices = mesh.lods[0].indices;
+            Vec3 lo = model.positions[indices[0]], hi = lo;
+            for (uint32_t i : indices)
+            {
+                const Vec3 &p = model.positions[i];
+                lo = {std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z)};
+                hi = {std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z)};
+            }
+            mesh.bounds_min = lo;
+            mesh.bounds_max = hi;
+            mesh.center = Vec3::scale(Vec3::add(lo, hi), 0.5f);
+            for (uint32_t i : indices)
+                mesh.radius = std::max(mesh.radius, Vec3::length(Vec3::subtract(model.positions[i], mesh.center)));
+        }
+    }
 
-                // Flat lighting
-                float intensity = Vec3::dot(face_normal, Vec3::scale(light_direction, -1.0f));
-                intensity = std::max(0.1f, intensity); // Ambient light
-                char ascii_char = get_ascii_char(intensity);
+    if (!any_texcoords)
+        std::vector<TexCoord>().swap(model.texcoords);
 
-                // Transform vertices
-                Vec4 v_clip[3];
-                Vec3 v_ndc[3];
-                Vec3 v_screen[3];
-                float inv_w[3];
+    // Grouping by material keeps consecutive setup chunks on one material.
+    std::stable_sort(model.meshes.begin(), model.meshes.end(),
+                     [](const Mesh &a, const Mesh &b) { return a.material < b.material; });
+    return model;
+}
 
-                bool behind_camera = false;
-                for (int i = 0; i < 3; ++i)
-                {
-                    v_clip[i] = mvp_matrix.transform({v_world[i].x, v_world[i].y, v_world[i].z, 1.0f});
-                    if (v_clip[i].w <= 0)
-                    { // Vertex is behind or on the camera plane
-                        behind_camera = true;
-                        break;
-                    }
+// Renumbers a mesh's indices into a compact 0..n range so per-vertex
+// scratch arrays scale with the mesh rather than the whole model. Returns
+// the model vertex for each local index.
+std::vector<uint32_t> localize_indices(const std::vector<uint32_t> &indices, std::vector<uint32_t> *local)
+{
+    std::vector<uint32_t> verts(indices);
+    std::sort(verts.begin(), verts.end());
+    verts.erase(std::unique(verts.begin(), verts.end()), verts.end());
+    local->resize(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i)
+        (*local)[i] = static_cast<uint32_t>(std::lower_bound(verts.begin(), verts.end(), indices[i]) - verts.begin());
+    return verts;
+}
 
-                    inv_w[i] = 1.0f / v_clip[i].w;
-                    v_ndc[i] = {v_clip[i].x * inv_w[i], v_clip[i].y * inv_w[i], v_clip[i].z * inv_w[i]};
+// --- Vertex Cache Optimization ---
 
-                    v_screen[i] = {
-                        (v_ndc[i].x + 1.0f) * 0.5f * SCREEN_WIDTH,
-                        (1.0f - v_ndc[i].y) * 0.5f * SCREEN_HEIGHT,
-                        v_ndc[i].z // Not used in screen space, just for barycentric struct
-                    };
-                }
-                if (behind_camera)
-                    continue;
+// Average cache miss ratio: transformed vertices per triangle for a FIFO
+// post-transform cache of the given size. 0.5 is ideal for large grids, 3.0
+// means no reuse at all.
+float compute_acmr(const std::vector<uint32_t> &indices, size_t vertex_count, size_t cache_size = 16)
+{
+    if (indices.empty())
+        return 0.0f;
+    std::vector<int64_t> inserted_at(vertex_count, std::numeric_limits<int64_t>::min() / 2);
+    int64_t misses = 0;
+    for (uint32_t v : indices)
+    {
+        if (misses - inserted_at[v] >= static_cast<int64_t>(cache_size))
+            inserted_at[v] = misses++;
+    }
+    return static_cast<float>(misses) / (indices.size() / 3);
+}
 
-                // Rasterize triangle
-                int minX = std::max(0, static_cast<int>(std::min({v_screen[0].x, v_screen[1].x, v_screen[2].x})));
-                int maxX = std::min(SCREEN_WIDTH - 1, static_cast<int>(std::ceil(std::max({v_screen[0].x, v_screen[1].x, v_screen[2].x}))));
-                int minY = std::max(0, static_cast<int>(std::min({v_screen[0].y, v_screen[1].y, v_screen[2].y})));
-                int maxY = std::min(SCREEN_HEIGHT - 1, static_cast<int>(std::ceil(std::max({v_screen[0].y, v_screen[1].y, v_screen[2].y}))));
+// Tom Forsyth's linear-speed vertex cache optimisation: repeatedly emits
+// the triangle whose vertices score best against a simulated LRU cache,
+// favouring recently used vertices and vertices with few triangles left.
+void optimize_vertex_cache(std::vector<uint32_t> &indices)
+{
+    const int CACHE_SIZE = 32;
+    const size_t triangle_count = indices.size() / 3;
+    if (triangle_count < 2)
+        return;
 
-                for (int y = minY; y <= maxY; ++y)
-                {
-                    for (int x = minX; x <= maxX; ++x)
-                    {
-                        Vec3 p = {static_cast<float>(x) + 0.5f, static_cast<float>(y) + 0.5f, 0};
-                        Vec3 bc = barycentric(p, v_screen[0], v_screen[1], v_screen[2]);
+    std::vector<uint32_t> tris;
+    std::vector<uint32_t> verts = localize_indices(indices, &tris);
+    const size_t vertex_count = verts.size();
 
-                        if (bc.x < 0 || bc.y < 0 || bc.z < 0)
-                            continue;
+    auto vertex_score = [](int cache_pos, uint32_t live) {
+        if (live == 0)
+            return -1.0f;
+        float score = 0.0f;
+        if (cache_pos >= 0)
+            score = cache_pos < 3 ? 0.75f
+                                  : std::pow(1.0f - static_cast<float>(cache_pos - 3) / (CACHE_SIZE - 3), 1.5f);
+        return score + 2.0f / std::sqrt(static_cast<float>(live));
+    };
 
-                        float interpolated_inv_w = bc.x * inv_w[0] + bc.y * inv_w[1] + bc.z * inv_w[2];
+    // Vertex -> live triangle lists; emitted triangles are swap-removed.
+    std::vector<uint32_t> offsets(vertex_count + 1, 0), live(vertex_count, 0);
+    for (uint32_t v : tris)
+        ++offsets[v + 1];
+    for (size_t v = 0; v < vertex_count; ++v)
+    {
+        live[v] = offsets[v + 1];
+        offsets[v + 1] += offsets[v];
+    }
+    std::vector<uint32_t> adjacency(tris.size());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < tris.size(); ++i)
+        adjacency[fill[tris[i]]++] = static_cast<uint32_t>(i / 3);
 
-                        if (interpolated_inv_w > depth_buffer[y * SCREEN_WIDTH + x])
-                        {
-                            depth_buffer[y * SCREEN_WIDTH + x] = interpolated_inv_w;
-                            char_buffer[y * SCREEN_WIDTH + x] = ascii_char;
-                        }
-                    }
-                }
-            }
+    std::vector<int> cache_pos(vertex_count, -1);
+    std::vector<float> score(vertex_count), tri_score(triangle_count, 0.0f);
+    for (size_t v = 0; v < vertex_count; ++v)
+        score[v] = vertex_score(-1, live[v]);
+    for (size_t t = 0; t < triangle_count; ++t)
+        tri_score[t] = score[tris[t * 3]] + score[tris[t * 3 + 1]] + score[tris[t * 3 + 2]];
+
+    std::vector<unsigned char> emitted(triangle_count, 0);
+    std::vector<uint32_t> cache, next_cache, output;
+    output.reserve(indices.size());
+    size_t cursor = 0;
+    int64_t best = 0;
+    for (size_t t = 1; t < triangle_count; ++t)
+        if (tri_score[t] > tri_score[best])
+            best = static_cast<int64_t>(t);
+
+    for (size_t n = 0; n < triangle_count; ++n)
+    {
+        if (best < 0)
+        {
+            // Nothing adjacent to the cache is left: resume the linear scan.
+            while (emitted[cursor])
+                ++cursor;
+            best = static_cast<int64_t>(cursor);
+        }
+        const uint32_t *tri = &tris[best * 3];
+        emitted[best] = 1;
+        for (int i = 0; i < 3; ++i)
+        {
+            uint32_t v = tri[i];
+            output.push_back(v);
+            uint32_t *begin = &adjacency[offsets[v]], *end = begin + live[v];
+            *std::find(begin, end, static_cast<uint32_t>(best)) = end[-1];
+            --live[v];
+        }
+
+        // New LRU order: this triangle's vertices first, then the old cache.
+        next_cache.assign(tri, tri + 3);
+        for (uint32_t v : cache)
+            if (v != tri[0] && v != tri[1] && v != tri[2])
+                next_cache.push_back(v);
+        for (size_t i = 0; i < next_cache.size(); ++i)
+        {
+            uint32_t v = next_cache[i];
+            cache_pos[v] = i < CACHE_SIZE ? static_cast<int>(i) : -1;
+            score[v] = vertex_score(cache_pos[v], live[v]);
         }
 
-        // Render the character buffer to the screen
-        for (int y = 0; y < SCREEN_HEIGHT; ++y)
+        best = -1;
+        float best_score = -1.0f;
+        for (uint32_t v : next_cache)
         {
-            for (int x = 0; x < SCREEN_WIDTH; ++x)
+            for (uint32_t k = offsets[v]; k < offsets[v] + live[v]; ++k)
             {
-                char c = char_buffer[y * SCREEN_WIDTH + x];
-                if (c != ' ' && char_texture_cache.count(c))
+                uint32_t t = adjacency[k];
+                tri_score[t] = score[tris[t * 3]] + score[tris[t * 3 + 1]] + score[tris[t * 3 + 2]];
+                if (tri_score[t] > best_score)
                 {
-                    SDL_Rect dst_rect = {x * font_width, y * font_height, font_width, font_height};
-                    SDL_RenderCopy(renderer, char_texture_cache[c], NULL, &dst_rect);
+                    best_score = tri_score[t];
+                    best = t;
                 }
             }
         }
+        if (next_cache.size() > CACHE_SIZE)
+            next_cache.resize(CACHE_SIZE);
+        std::swap(cache, next_cache);
+    }
 
-        SDL_RenderPresent(renderer);
-        SDL_Delay(10);
+    for (size_t i = 0; i < output.size(); ++i)
+        indices[i] = verts[output[i]];
+}
+
+// Renumbers vertices in order of first use across every mesh's full-detail
+// triangles, so the per-frame vertex transform walks memory forwards.
+void optimize_vertex_fetch(Model &model)
+{
+    const uint32_t unused = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> remap(model.positions.size(), unused);
+    uint32_t next = 0;
+    for (const Mesh &mesh : model.meshes)
+        for (uint32_t v : mesh.lods[0].indices)
+            if (remap[v] == unused)
+                remap[v] = next++;
+
+    std::vector<Vec3> positions(next), normals(next);
+    std::vector<TexCoord> texcoords(model.texcoords.empty() ? 0 : next);
+    for (size_t v = 0; v < remap.size(); ++v)
+    {
+        if (remap[v] == unused)
+            continue;
+        positions[remap[v]] = model.positions[v];
+        normals[remap[v]] = model.normals[v];
+        if (!texcoords.empty())
+            texcoords[remap[v]] = model.texcoords[v];
     }
+    model.positions.swap(positions);
+    model.normals.swap(normals);
+    model.texcoords.swap(texcoords);
+    for (Mesh &mesh : model.meshes)
+        for (MeshLod &lod : mesh.lods)
+            for (uint32_t &v : lod.indices)
+                v = remap[v];
+}
 
-    // 6. Cleanup
-    for (auto const &[key, val] : char_texture_cache)
+// Cache-orders every mesh's full-detail triangles, then vertex order.
+// Returns the model-wide ACMR before and after.
+std::pair<float, float> optimize_model(Model &model)
+{
+    std::vector<uint32_t> all;
+    for (const Mesh &mesh : model.meshes)
+        all.insert(all.end(), mesh.lods[0].indices.begin(), mesh.lods[0].indices.end());
+    float before = compute_acmr(all, model.positions.size());
+
+    for (Mesh &mesh : model.meshes)
+        optimize_vertex_cache(mesh.lods[0].indices);
+    optimize_vertex_fetch(model);
+
+    all.clear();
+    for (const Mesh &mesh : model.meshes)
+        all.insert(all.end(), mesh.lods[0].indices.begin(), mesh.lods[0].indices.end());
+    return {before, compute_acmr(all, model.positions.size())};
+}
+
+// --- Mesh Simplification ---
+
+// Symmetric 4x4 error quadric: the sum of squared distances to a set of planes.
+struct Quadric
+{
+    double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+
+    static Quadric from_plane(double a, double b, double c, double d)
+    {
+        return {a * a, a * b, a * c, a * d, b * b, b * c, b * d, c * c, c * d, d * d};
+    }
+
+    void add(const Quadric &q)
     {
-        SDL_DestroyTexture(val);
+        a2 += q.a2, ab += q.ab, ac += q.ac, ad += q.ad, b2 += q.b2;
+        bc += q.bc, bd += q.bd, c2 += q.c2, cd += q.cd, d2 += q.d2;
     }
+
+    double evaluate(const Vec3 &p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        return a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x + b2 * y * y +
+               2 * bc * y * z + 2 * bd * y + c2 * z * z + 2 * cd * z + d2;
+    }
+};
+
+// Quadric error metric edge collapse (Garland & Heckbert). A vertex is only
+// ever collapsed onto one of its neighbours, so every LOD indexes the same
+// positions array. Border and non-manifold vertices are locked in place to
+// keep shapes watertight against each other. Collapses are applied in
+// cheapest-first batches of non-overlapping neighbourhoods, which keeps the
+// flip check valid without a priority queue. Plane quadrics are unweighted,
+// so sqrt(cost) bounds the distance to every original plane; the largest is
+// written to out_error.
+std::vector<uint32_t> simplify_mesh(const std::vector<Vec3> &positions, const std::vector<uint32_t> &indices,
+                                    size_t target_triangles, float *out_error)
+{
+    std::vector<uint32_t> tris;
+    std::vector<uint32_t> verts = localize_indices(indices, &tris);
+    const size_t vertex_count = verts.size();
+    auto pos = [&](uint32_t v) -> const Vec3 & { return positions[verts[v]]; };
+
+    std::vector<Quadric> quadrics(vertex_count);
+    for (size_t t = 0; t < tris.size(); t += 3)
+    {
+        Vec3 n = Vec3::cross(Vec3::subtract(pos(tris[t + 1]), pos(tris[t])), Vec3::subtract(pos(tris[t + 2]), pos(tris[t])));
+        if (Vec3::length(n) == 0.0f)
+            continue;
+        n = Vec3::normalize(n);
+        Quadric q = Quadric::from_plane(n.x, n.y, n.z, -Vec3::dot(n, pos(tris[t])));
+        for (int i = 0; i < 3; ++i)
+            quadrics[tris[t + i]].add(q);
+    }
+
+    auto edge_key = [](uint32_t a, uint32_t b) { return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a; };
+    std::vector<uint64_t> edges;
+    edges.reserve(tris.size());
+    for (size_t t = 0; t < tris.size(); t += 3)
+        for (int i = 0; i < 3; ++i)
+            edges.push_back(edge_key(tris[t + i], tris[t + (i + 1) % 3]));
+    std::sort(edges.begin(), edges.end());
+
+    std::vector<unsigned char> locked(vertex_count, 0);
+    for (size_t i = 0; i < edges.size();)
+    {
+        size_t run = i;
+        while (run < edges.size() && edges[run] == edges[i])
+            ++run;
+        if (run - i != 2)
+            locked[edges[i] >> 32] = locked[edges[i] & 0xFFFFFFFF] = 1;
+        i = run;
+    }
+
+    struct Collapse
+    {
+        uint32_t from, to;
+        double cost;
+    };
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> adjacency_offsets, adjacency;
+    std::vector<unsigned char> touched(vertex_count);
+    std::vector<uint32_t> remap(vertex_count);
+    double max_cost = 0.0;
+
+    while (tris.size() / 3 > target_triangles)
+    {
+        // Vertex -> triangle adjacency for this pass.
+        adjacency_offsets.assign(vertex_count + 1, 0);
+        for (uint32_t v : tris)
+            ++adjacency_offsets[v + 1];
+        for (size_t v = 0; v < vertex_count; ++v)
+            adjacency_offsets[v + 1] += adjacency_offsets[v];
+        adjacency.resize(tris.size());
+        std::vector<uint32_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+        for (size_t i = 0; i < tris.size(); ++i)
+            adjacency[fill[tris[i]]++] = static_cast<uint32_t>(i / 3);
+
+        edges.clear();
+        for (size_t t = 0; t < tris.size(); t += 3)
+            for (int i = 0; i < 3; ++i)
+                edges.push_back(edge_key(tris[t + i], tris[t + (i + 1) % 3]));
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+        collapses.clear();
+        for (uint64_t key : edges)
+        {
+            uint32_t a = static_cast<uint32_t>(key >> 32), b = static_cast<uint32_t>(key & 0xFFFFFFFF);
+            Quadric q = quadrics[a];
+            q.add(quadrics[b]);
+            if (!locked[a])
+                collapses.push_back({a, b, std::max(0.0, q.evaluate(pos(b)))});
+            if (!locked[b])
+                collapses.push_back({b, a, std::max(0.0, q.evaluate(pos(a)))});
+        }
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const Collapse &l, const Collapse &r) { return l.cost < r.cost; });
+
+        // Each collapse removes about two triangles.
+        size_t wanted = (tris.size() / 3 - target_triangles + 1) / 2;
+        size_t done = 0;
+        std::fill(touched.begin(), touched.end(), 0);
+        for (size_t v = 0; v < vertex_count; ++v)
+            remap[v] = static_cast<uint32_t>(v);
+
+        for (const Collapse &c : collapses)
+        {
+            if (done >= wanted)
+                break;
+            if (touched[c.from] || touched[c.to])
+                continue;
+
+            // Reject collapses that would flip a surviving triangle.
+            bool flips = false;
+            for (uint32_t k = adjacency_offsets[c.from]; k < adjacency_offsets[c.from + 1] && !flips; ++k)
+            {
+                const uint32_t *t = &tris[adjacency[k] * 3];
+                if (t[0] == c.to || t[1] == c.to || t[2] == c.to)
+                    continue;
+                Vec3 p[3], q[3];
+                for (int i = 0; i < 3; ++i)
+                {
+                    p[i] = pos(t[i]);
+                    q[i] = t[i] == c.from ? pos(c.to) : p[i];
+                }
+                Vec3 n0 = Vec3::cross(Vec3::subtract(p[1], p[0]), Vec3::subtract(p[2], p[0]));
+                Vec3 n1 = Vec3::cross(Vec3::subtract(q[1], q[0]), Vec3::subtract(q[2], q[0]));
+                flips = Vec3::dot(n0, n1) <= 0.0f;
+            }
+            if (flips)
+                continue;
+
+            remap[c.from] = c.to;
+            quadrics[c.to].add(quadrics[c.from]);
+            max_cost = std::max(max_cost, c.cost);
+            for (uint32_t v : {c.from, c.to})
+                for (uint32_t k = adjacency_offsets[v]; k < adjacency_offsets[v + 1]; ++k)
+                    for (int i = 0; i < 3; ++i)
+                        touched[tris[adjacency[k] * 3 + i]] = 1;
+            ++done;
+        }
+        if (done == 0)
+            break;
+
+        size_t out = 0;
+        for (size_t t = 0; t < tris.size(); t += 3)
+        {
+            uint32_t a = remap[tris[t]], b = remap[tris[t + 1]], c = remap[tris[t + 2]];
+            if (a == b || b == c || a == c)
+                continue;
+            tris[out++] = a;
+            tris[out++] = b;
+            tris[out++] = c;
+        }
+        tris.resize(out);
+    }
+
+    for (uint32_t &v : tris)
+        v = verts[v];
+    *out_error = static_cast<float>(std::sqrt(max_cost));
+    return tris;
+}
+
+const size_t MAX_LODS = 8;
+const size_t LOD_MIN_TRIANGLES = 32;
+
+// Halves the triangle count per level until simplification stalls. Each
+// level is simplified from the previous one, so errors accumulate.
+void build_lods(const std::vector<Vec3> &positions, Mesh &mesh)
+{
+    mesh.lods.resize(1);
+    while (mesh.lods.size() < MAX_LODS)
+    {
+        const MeshLod &prev = mesh.lods.back();
+        size_t triangles = prev.indices.size() / 3;
+        if (triangles < LOD_MIN_TRIANGLES)
+            break;
+        MeshLod next;
+        next.indices = simplify_mesh(positions, prev.indices, triangles / 2, &next.error);
+        if (next.indices.size() > prev.indices.size() * 9 / 10)
+            break;
+        next.error += prev.error;
+        optimize_vertex_cache(next.indices);
+        mesh.lods.push_back(std::move(next));
+    }
+}
+
+// LOD chains are cached next to the OBJ as "<obj>.lod", keyed by the OBJ's
+// size and modification time so an edited model is rebuilt. Each chain also
+// records its mesh's full-detail index count, since how shapes split into
+// meshes depends on the MTL file too.
+const uint32_t LOD_CACHE_MAGIC = 0x444F4C41; // "ALOD"
+const uint32_t LOD_CACHE_VERSION = 3;
+
+struct FileStamp
+{
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+bool stat_file(const std::string &path, FileStamp *stamp)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+    stamp->size = static_cast<uint64_t>(st.st_size);
+    stamp->mtime = static_cast<int64_t>(st.st_mtime);
+    return true;
+}
+
+template <typename T>
+static bool read_pod(std::istream &in, T *value)
+{
+    return static_cast<bool>(in.read(reinterpret_cast<char *>(value), sizeof(T)));
+}
+
+template <typename T>
+static void write_pod(std::ostream &out, const T &value)
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+bool load_lod_cache(const std::string &cache_path, const FileStamp &stamp, Model &model)
+{
+    std::ifstream in(cache_path, std::ios::binary);
+    uint32_t magic, version, mesh_count;
+    FileStamp cached;
+    if (!read_pod(in, &magic) || !read_pod(in, &version) || !read_pod(in, &cached.size) ||
+        !read_pod(in, &cached.mtime) || !read_pod(in, &mesh_count))
+        return false;
+    if (magic != LOD_CACHE_MAGIC || version != LOD_CACHE_VERSION || cached.size != stamp.size ||
+        cached.mtime != stamp.mtime || mesh_count != model.meshes.size())
+        return false;
+
+    std::vector<std::vector<MeshLod>> chains(mesh_count);
+    for (size_t m = 0; m < mesh_count; ++m)
+    {
+        std::vector<MeshLod> &chain = chains[m];
+        uint32_t full_index_count, lod_count;
+        if (!read_pod(in, &full_index_count) || full_index_count != model.meshes[m].lods[0].indices.size() ||
+            !read_pod(in, &lod_count) || lod_count > MAX_LODS)
+            return false;
+        chain.resize(lod_count);
+        for (MeshLod &lod : chain)
+        {
+            uint32_t index_count;
+            if (!read_pod(in, &lod.error) || !read_pod(in, &index_count) || index_count % 3 != 0)
+                return false;
+            lod.indices.resize(index_count);
+            if (!in.read(reinterpret_cast<char *>(lod.indices.data()), index_count * sizeof(uint32_t)))
+                return false;
+            for (uint32_t i : lod.indices)
+                if (i >= model.positions.size())
+                    return false;
+        }
+    }
+    for (size_t m = 0; m < mesh_count; ++m)
+    {
+        model.meshes[m].lods.resize(1);
+        for (MeshLod &lod : chains[m])
+            model.meshes[m].lods.push_back(std::move(lod));
+    }
+    return true;
+}
+
+// Best effort: a read-only model directory just means no cache.
+void save_lod_cache(const std::string &cache_path, const FileStamp &stamp, const Model &model)
+{
+    std::ofstream out(cache_path, std::ios::binary);
+    if (!out)
+        return;
+    write_pod(out, LOD_CACHE_MAGIC);
+    write_pod(out, LOD_CACHE_VERSION);
+    write_pod(out, stamp.size);
+    write_pod(out, stamp.mtime);
+    write_pod(out, static_cast<uint32_t>(model.meshes.size()));
+    for (const Mesh &mesh : model.meshes)
+    {
+        write_pod(out, static_cast<uint32_t>(mesh.lods[0].indices.size()));
+        write_pod(out, static_cast<uint32_t>(mesh.lods.size() - 1));
+        for (size_t l = 1; l < mesh.lods.size(); ++l)
+        {
+            write_pod(out, mesh.lods[l].error);
+            write_pod(out, static_cast<uint32_t>(mesh.lods[l].indices.size()));
+            out.write(reinterpret_cast<const char *>(mesh.lods[l].indices.data()),
+                      mesh.lods[l].indices.size() * sizeof(uint32_t));
+        }
+    }
+}
+
+// --- Vertex Quantization ---
+
+// Packs a unit normal into 8 bits per axis of an octahedral map: the
+// normal is projected onto the octahedron |x| + |y| + |z| = 1 and the lower
+// half folded over the upper one. A zero normal (none in the OBJ) encodes
+// as the centre of the map.
+uint16_t encode_octahedral(const Vec3 &n)
+{
+    float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    float u = 0.0f, v = 0.0f;
+    if (l1 > 0.0f)
+    {
+        u = n.x / l1;
+        v = n.y / l1;
+        if (n.z < 0.0f)
+        {
+            float fold_u = (1.0f - std::abs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+            float fold_v = (1.0f - std::abs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+            u = fold_u;
+            v = fold_v;
+        }
+    }
+    auto to_byte = [](float f) { return static_cast<uint16_t>(std::lround((f * 0.5f + 0.5f) * 255.0f)); };
+    return static_cast<uint16_t>(to_byte(u) | to_byte(v) << 8);
+}
+
+Vec3 decode_octahedral(uint16_t packed)
+{
+    float u = (packed & 0xFF) / 255.0f * 2.0f - 1.0f;
+    float v = (packed >> 8) / 255.0f * 2.0f - 1.0f;
+    Vec3 n = {u, v, 1.0f - std::abs(u) - std::abs(v)};
+    if (n.z < 0.0f)
+    {
+        n.x = (1.0f - std::abs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        n.y = (1.0f - std::abs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+    }
+    return Vec3::normalize(n);
+}
+
+// Converts a model to compact storage: each mesh gets its own run of
+// QuantizedVertex (8 bytes instead of 24), quantized over the mesh's
+// bounding box, and 16-bit indices when it has few enough vertices. The
+// full-precision positions and normals are released; texcoords are kept at
+// full precision in the new order. Vertices shared between meshes are
+// duplicated so every mesh's run is self-contained.
+void quantize_model(Model &model)
+{
+    std::vector<QuantizedVertex> quantized;
+    std::vector<TexCoord> texcoords;
+    for (Mesh &mesh : model.meshes)
+    {
+        std::vector<uint32_t> all, local;
+        for (const MeshLod &lod : mesh.lods)
+            all.insert(all.end(), lod.indices.begin(), lod.indices.end());
+        std::vector<uint32_t> verts = localize_indices(all, &local);
+
+        mesh.vertex_base = static_cast<uint32_t>(quantized.size());
+        mesh.vertex_count = static_cast<uint32_t>(verts.size());
+        Vec3 extent = Vec3::subtract(mesh.bounds_max, mesh.bounds_min);
+        mesh.quantization_step = Vec3::scale(extent, 1.0f / QUANTIZED_MAX);
+        auto quantize = [](float value, float lo, float extent) {
+            return static_cast<uint16_t>(extent > 0.0f ? std::lround((value - lo) / extent * QUANTIZED_MAX) : 0);
+        };
+        for (uint32_t v : verts)
+        {
+            const Vec3 &p = model.positions[v];
+            quantized.push_back({quantize(p.x, mesh.bounds_min.x, extent.x), quantize(p.y, mesh.bounds_min.y, extent.y),
+                                 quantize(p.z, mesh.bounds_min.z, extent.z), encode_octahedral(model.normals[v])});
+            if (!model.texcoords.empty())
+                texcoords.push_back(model.texcoords[v]);
+        }
+
+        bool narrow = verts.size() <= 65536;
+        size_t offset = 0;
+        for (MeshLod &lod : mesh.lods)
+        {
+            size_t count = lod.indices.size();
+            if (narrow)
+            {
+                lod.indices16.assign(local.begin() + offset, local.begin() + offset + count);
+                std::vector<uint32_t>().swap(lod.indices);
+            }
+            else
+                std::copy(local.begin() + offset, local.begin() + offset + count, lod.indices.begin());
+            offset += count;
+        }
+    }
+    model.quantized.swap(quantized);
+    model.texcoords.swap(texcoords);
+    std::vector<Vec3>().swap(model.positions);
+    std::vector<Vec3>().swap(model.normals);
+}
+
+// Heap bytes held by a model's vertices and indices.
+size_t model_bytes(const Model &model)
+{
+    size_t bytes = model.positions.capacity() * sizeof(Vec3) + model.normals.capacity() * sizeof(Vec3) +
+                   model.quantized.capacity() * sizeof(QuantizedVertex) +
+                   model.texcoords.capacity() * sizeof(TexCoord);
+    for (const Mesh &mesh : model.meshes)
+        for (const MeshLod &lod : mesh.lods)
+            bytes += lod.indices.capacity() * sizeof(uint32_t) + lod.indices16.capacity() * sizeof(uint16_t);
+    return bytes;
+}
+
+// --- OBJ Ingestion ---
+
+// A whole file mapped read-only into memory.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile()
+    {
+        if (data)
+            munmap(const_cast<char *>(data), size);
+    }
+
+    bool open(const std::string &path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+        if (ok && st.st_size > 0)
+        {
+            size = static_cast<size_t>(st.st_size);
+            void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED)
+                ok = false;
+            else
+            {
+                data = static_cast<const char *>(mapped);
+                madvise(mapped, size, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd); // The mapping stays valid without the descriptor
+        return ok;
+    }
+
+    const char *begin() const { return data; }
+    const char *end() const { return data + size; }
+
+    // Drops the resident pages wholly before `up_to`, so a sequential scan
+    // keeps only a window of the file in memory. They are faulted back in
+    // from the page cache if touched again.
+    void release(const char *up_to) const
+    {
+        const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t bytes = static_cast<size_t>(up_to - data) / page * page;
+        if (bytes > 0)
+            madvise(const_cast<char *>(data), bytes, MADV_DONTNEED);
+    }
+
+private:
+    const char *data = nullptr;
+    size_t size = 0;
+};
+
+// Cursor over one line of a mapped OBJ; never reads past the line's end.
+struct ObjLine
+{
+    const char *p, *end;
+
+    void skip_space()
+    {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            ++p;
+    }
+
+    bool keyword(const char *word)
+    {
+        size_t n = std::strlen(word);
+        if (static_cast<size_t>(end - p) < n || std::memcmp(p, word, n) != 0 ||
+            (p + n < end && p[n] != ' ' && p[n] != '\t'))
+            return false;
+        p += n;
+        skip_space();
+        return true;
+    }
+
+    bool parse_float(float *value)
+    {
+        skip_space();
+        if (p < end && *p == '+')
+            ++p;
+        double parsed;
+        auto result = std::from_chars(p, end, parsed);
+        if (result.ec != std::errc())
+            return false;
+        p = result.ptr;
+        *value = static_cast<float>(parsed);
+        return true;
+    }
+
+    bool parse_int(int *value)
+    {
+        auto result = std::from_chars(p, end, *value);
+        if (result.ec != std::errc())
+            return false;
+        p = result.ptr;
+        return true;
+    }
+
+    // The rest of the line without surrounding space, e.g. a name.
+    std::string rest() const
+    {
+        const char *last = end;
+        while (last > p && (last[-1] == ' ' || last[-1] == '\t'))
+            --last;
+        return std::string(p, last);
+    }
+};
+
+// Calls visit(ObjLine&, line_number) for every non-blank, non-comment line,
+// positioned after any leading space. Stops early if visit returns false.
+template <typename Visit>
+bool for_each_obj_line(const MappedFile &file, Visit visit)
+{
+    const size_t RELEASE_INTERVAL = 1 << 20;
+    const char *end = file.end(), *released = file.begin();
+    size_t line_number = 0;
+    for (const char *p = file.begin(); p < end;)
+    {
+        if (static_cast<size_t>(p - released) >= RELEASE_INTERVAL)
+        {
+            file.release(p);
+            released = p;
+        }
+        const char *line_end = static_cast<const char *>(std::memchr(p, '\n', end - p));
+        if (!line_end)
+            line_end = end;
+        ObjLine line = {p, line_end};
+        if (line.end > line.p && line.end[-1] == '\r')
+            --line.end;
+        p = line_end + 1;
+        ++line_number;
+        line.skip_space();
+        if (line.p == line.end || *line.p == '#')
+            continue;
+        if (!visit(line, line_number))
+            return false;
+    }
+    file.release(end);
+    return true;
+}
+
+// Parses an OBJ straight from its mapped bytes into tinyobj's structures,
+// for build_model(). A counting pass first sizes every output vector, so
+// the parse itself does no per-line allocation or copying. Supports v, vn,
+// vt, f, o, g, s, usemtl and mtllib (resolved next to the OBJ); quads are
+// split along the shorter diagonal like tinyobj, larger polygons are
+// fanned, and other statements are ignored.
+bool load_obj_mapped(const std::string &path, tinyobj::attrib_t *attrib, std::vector<tinyobj::shape_t> *shapes,
+                     std::vector<tinyobj::material_t> *materials, std::string *error)
+{
+    MappedFile file;
+    if (!file.open(path))
+    {
+        *error = "Cannot open file [" + path + "]";
+        return false;
+    }
+
+    // Counting pass: attribute totals, and triangles per o/g segment.
+    size_t v_count = 0, vn_count = 0, vt_count = 0;
+    std::vector<size_t> segment_triangles(1, 0);
+    for_each_obj_line(file, [&](ObjLine &line, size_t) {
+        if (line.keyword("v"))
+            ++v_count;
+        else if (line.keyword("vn"))
+            ++vn_count;
+        else if (line.keyword("vt"))
+            ++vt_count;
+        else if (line.keyword("f"))
+        {
+            int corners = 0;
+            while (line.p < line.end)
+            {
+                ++corners;
+                while (line.p < line.end && *line.p != ' ' && *line.p != '\t')
+                    ++line.p;
+                line.skip_space();
+            }
+            segment_triangles.back() += corners >= 3 ? corners - 2 : 0;
+        }
+        else if (line.keyword("o") || line.keyword("g"))
+            segment_triangles.push_back(0);
+        return true;
+    });
+
+    attrib->vertices.clear();
+    attrib->normals.clear();
+    attrib->texcoords.clear();
+    attrib->vertices.reserve(v_count * 3);
+    attrib->normals.reserve(vn_count * 3);
+    attrib->texcoords.reserve(vt_count * 2);
+    shapes->clear();
+    materials->clear();
+
+    std::string base_dir = path.substr(0, path.find_last_of('/') + 1);
+    std::map<std::string, int> material_map;
+    int material = -1;
+    unsigned int smoothing = 0;
+    size_t segment = 0;
+    tinyobj::shape_t shape;
+    shape.mesh.indices.reserve(segment_triangles[0] * 3);
+    std::vector<tinyobj::index_t> corners;
+
+    auto start_shape = [&](std::string name) {
+        if (!shape.mesh.indices.empty())
+            shapes->push_back(std::move(shape));
+        shape = tinyobj::shape_t();
+        shape.name = std::move(name);
+        size_t triangles = segment_triangles[++segment];
+        shape.mesh.indices.reserve(triangles * 3);
+        shape.mesh.num_face_vertices.reserve(triangles);
+        shape.mesh.material_ids.reserve(triangles);
+        shape.mesh.smoothing_group_ids.reserve(triangles);
+    };
+    auto emit = [&](const tinyobj::index_t &a, const tinyobj::index_t &b, const tinyobj::index_t &c) {
+        shape.mesh.indices.push_back(a);
+        shape.mesh.indices.push_back(b);
+        shape.mesh.indices.push_back(c);
+        shape.mesh.num_face_vertices.push_back(3);
+        shape.mesh.material_ids.push_back(material);
+        shape.mesh.smoothing_group_ids.push_back(smoothing);
+    };
+    // OBJ indices are 1-based, or negative to count back from the latest.
+    auto resolve = [](int index, size_t count, int *out) {
+        *out = index > 0 ? index - 1 : static_cast<int>(count) + index;
+        return index != 0 && *out >= 0 && *out < static_cast<int>(count);
+    };
+
+    bool ok = for_each_obj_line(file, [&](ObjLine &line, size_t line_number) {
+        auto fail = [&](const char *what) {
+            *error = std::string("Failed to parse ") + what + " at line " + std::to_string(line_number) + " of " + path;
+            return false;
+        };
+        float x, y, z;
+        if (line.keyword("v"))
+        {
+            if (!line.parse_float(&x) || !line.parse_float(&y) || !line.parse_float(&z))
+                return fail("vertex");
+            attrib->vertices.insert(attrib->vertices.end(), {x, y, z});
+        }
+        else if (line.keyword("vn"))
+        {
+            if (!line.parse_float(&x) || !line.parse_float(&y) || !line.parse_float(&z))
+                return fail("normal");
+            attrib->normals.insert(attrib->normals.end(), {x, y, z});
+        }
+        else if (line.keyword("vt"))
+        {
+            if (!line.parse_float(&x))
+                return fail("texcoord");
+            if (!line.parse_float(&y))
+                y = 0.0f;
+            attrib->texcoords.insert(attrib->texcoords.end(), {x, y});
+        }
+        else if (line.keyword("f"))
+        {
+            size_t positions = attrib->vertices.size() / 3;
+            corners.clear();
+            while (line.p < line.end)
+            {
+                tinyobj::index_t corner = {-1, -1, -1};
+                int index;
+                if (!line.parse_int(&index) || !resolve(index, positions, &corner.vertex_index))
+                    return fail("face");
+                if (line.p < line.end && *line.p == '/')
+                {
+                    ++line.p;
+                    if (line.p < line.end && *line.p != '/' &&
+                        (!line.parse_int(&index) || !resolve(index, attrib->texcoords.size() / 2, &corner.texcoord_index)))
+                        return fail("face");
+                    if (line.p < line.end && *line.p == '/')
+                    {
+                        ++line.p;
+                        if (!line.parse_int(&index) || !resolve(index, attrib->normals.size() / 3, &corner.normal_index))
+                            return fail("face");
+                    }
+                }
+                corners.push_back(corner);
+                line.skip_space();
+            }
+            if (corners.size() == 4)
+            {
+                const float *v = attrib->vertices.data();
+                auto distance2 = [&](int a, int b) {
+                    float dx = v[3 * b] - v[3 * a], dy = v[3 * b + 1] - v[3 * a + 1], dz = v[3 * b + 2] - v[3 * a + 2];
+                    return dx * dx + dy * dy + dz * dz;
+                };
+                if (distance2(corners[0].vertex_index, corners[2].vertex_index) <
+                    distance2(corners[1].vertex_index, corners[3].vertex_index))
+                {
+                    emit(corners[0], corners[1], corners[2]);
+                    emit(corners[0], corners[2], corners[3]);
+                }
+                else
+                {
+                    emit(corners[0], corners[1], corners[3]);
+                    emit(corners[1], corners[2], corners[3]);
+                }
+            }
+            else
+            {
+                for (size_t i = 2; i < corners.size(); ++i)
+                    emit(corners[0], corners[i - 1], corners[i]);
+            }
+        }
+        else if (line.keyword("o") || line.keyword("g"))
+            start_shape(line.rest());
+        else if (line.keyword("s"))
+        {
+            int id = 0;
+            smoothing = line.parse_int(&id) && id > 0 ? static_cast<unsigned int>(id) : 0;
+        }
+        else if (line.keyword("usemtl"))
+        {
+            auto it = material_map.find(line.rest());
+            material = it != material_map.end() ? it->second : -1;
+        }
+        else if (line.keyword("mtllib"))
+        {
+            std::ifstream mtl(base_dir + line.rest());
+            std::string warn, err;
+            if (mtl)
+                tinyobj::LoadMtl(&material_map, materials, &mtl, &warn, &err);
+        }
+        return true;
+    });
+    if (!ok)
+        return false;
+    if (!shape.mesh.indices.empty())
+        shapes->push_back(std::move(shape));
+    return true;
+}
+
+// --- Model Loading ---
+
+// Loads each material's map_Kd, relative to the OBJ's directory, once per
+// distinct file. Only binary PGM/PPM images are read; a texture that can't
+// be leaves its materials untextured. Models without texture coordinates
+// skip this entirely.
+void load_textures(const std::string &obj_path, const std::vector<tinyobj::material_t> &materials, Model &model)
+{
+    if (model.texcoords.empty())
+        return;
+    std::filesystem::path directory = std::filesystem::path(obj_path).parent_path();
+    std::map<std::string, int> loaded;
+    for (size_t m = 1; m < model.materials.size(); ++m)
+    {
+        const std::string &name = materials[m - 1].diffuse_texname;
+        if (name.empty())
+            continue;
+        std::string path = (directory / name).string();
+        auto found = loaded.find(path);
+        if (found == loaded.end())
+        {
+            std::vector<uint8_t> rows;
+            int width, height;
+            std::string error;
+            int index = -1;
+            if (load_netpbm_luminance(path, &rows, &width, &height, &error))
+            {
+                index = static_cast<int>(model.textures.size());
+                model.textures.emplace_back();
+                model.textures.back().build(std::move(rows), width, height);
+            }
+            else
+                std::cerr << "Texture not loaded: " << error << std::endl;
+            found = loaded.emplace(path, index).first;
+        }
+        model.materials[m].texture = found->second;
+    }
+}
+
+// Loads an OBJ and prepares it for rendering: welds and reorders vertices,
+// loads its textures, then loads or builds its LOD chains, and finally
+// quantizes it if compact is set. Safe to call from several threads at once for different files.
+// acmr receives the before/after cache miss ratio from optimize_model().
+bool load_model(const std::string &path, bool use_lods, bool compact, Model *model, std::pair<float, float> *acmr,
+                std::string *error)
+{
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warn, err;
+
+    // tinyobj is kept as the fallback for files the mapped parser rejects.
+    if (!load_obj_mapped(path, &attrib, &shapes, &materials, &err) &&
+        !tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path.c_str()))
+    {
+        *error = "Failed to load OBJ: " + warn + err;
+        return false;
+    }
+
+    *model = build_model(attrib, shapes, materials);
+    load_textures(path, materials, *model);
+    *acmr = optimize_model(*model);
+    if (use_lods)
+    {
+        FileStamp stamp;
+        std::string cache_path = path + ".lod";
+        bool have_stamp = stat_file(path, &stamp);
+        if (!have_stamp || !load_lod_cache(cache_path, stamp, *model))
+        {
+            for (Mesh &mesh : model->meshes)
+                build_lods(model->positions, mesh);
+            if (have_stamp)
+                save_lod_cache(cache_path, stamp, *model);
+        }
+    }
+    if (compact)
+        quantize_model(*model);
+    return true;
+}
+
+// --- Bounding Volume Hierarchy ---
+
+// A ray in model space. direction needn't be unit length; distances along
+// the ray are in multiples of it.
+struct Ray
+{
+    Vec3 origin;
+    Vec3 direction;
+};
+
+const uint32_t NO_FACE = 0xFFFFFFFFu;
+
+struct RayHit
+{
+    float t = 0.0f;
+    float u = 0.0f, v = 0.0f; // Barycentric weights of the face's second and third corners
+    uint32_t face = NO_FACE;  // See Bvh::locate()
+};
+
+// The model-wide index of corner i of a mesh's full-detail LOD, into
+// positions or, for a compact model, quantized, and into texcoords.
+uint32_t lod0_vertex(const Model &model, const Mesh &mesh, size_t i)
+{
+    const MeshLod &lod = mesh.lods[0];
+    if (!model.compact())
+        return lod.indices[i];
+    return mesh.vertex_base + (lod.indices16.empty() ? lod.indices[i] : lod.indices16[i]);
+}
+
+// The model-space position of corner i of a mesh's full-detail LOD.
+Vec3 lod0_position(const Model &model, const Mesh &mesh, size_t i)
+{
+    uint32_t v = lod0_vertex(model, mesh, i);
+    return model.compact() ? mesh.dequantize(model.quantized[v]) : model.positions[v];
+}
+
+// A bounding volume hierarchy over every full-detail triangle of a model,
+// for picking, occlusion queries and ray casting. It is built as a binary
+// tree with the binned surface area heuristic, then collapsed into nodes of
+// four children whose boxes a ray is tested against at once. Triangles are
+// copied in leaf order as a corner and two edges, so queries never touch the
+// model and work on compact models too. Faces are numbered across meshes in
+// order, each mesh's following its LOD 0. Like the rasterizer, queries only
+// see front faces.
+struct Bvh
+{
+    static const uint32_t LEAF = 0x80000000u; // A child that is a run of triangles rather than a node
+    static const int MAX_LEAF_TRIANGLES = 4;
+    static const int SAH_BINS = 12;
+    // Deeper binary subtrees are split at the median, which bounds the
+    // depth and so the traversal stack: past MAX_SAH_DEPTH each level halves
+    // a 32-bit face count, and a collapsed node lies at least one binary
+    // level below its parent. A traversal step pops one node and pushes at
+    // most four children, so the stack grows by at most three per level.
+    static const int MAX_SAH_DEPTH = 48;
+    static const int MAX_DEPTH = MAX_SAH_DEPTH + 32; // Of a collapsed node below the root
+    static const int STACK_SIZE = 256;
+    static_assert(STACK_SIZE >= 1 + 3 * MAX_DEPTH, "traversal stack too small for the deepest tree");
+
+    // Child boxes are stored by axis so one SIMD register holds a bound of
+    // all four.
+    struct alignas(16) Node
+    {
+        float min_x[4], min_y[4], min_z[4];
+        float max_x[4], max_y[4], max_z[4];
+        uint32_t child[4]; // Node index, or LEAF | first triangle
+        uint8_t count[4];  // Triangles in a leaf child
+        uint8_t occupied;  // Bit per child in use
+    };
+    struct Triangle
+    {
+        Vec3 v0, e1, e2; // e1 = v1 - v0, e2 = v2 - v0
+    };
+    struct Bounds
+    {
+        Vec3 lo = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+                   std::numeric_limits<float>::max()};
+        Vec3 hi = {-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(),
+                   -std::numeric_limits<float>::max()};
+
+        void grow(const Vec3 &p)
+        {
+            lo = {std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z)};
+            hi = {std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z)};
+        }
+        void grow(const Bounds &b)
+        {
+            grow(b.lo);
+            grow(b.hi);
+        }
+        float area() const
+        {
+            Vec3 d = Vec3::subtract(hi, lo);
+            return d.x < 0.0f ? 0.0f : 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+        }
+    };
+
+    std::vector<Node> nodes; // nodes[0] is the root
+    std::vector<Triangle> triangles;
+    std::vector<uint32_t> faces;           // Per triangle, its face number
+    std::vector<uint32_t> mesh_first_face; // Per mesh, plus the total
+
+    bool empty() const { return nodes.empty(); }
+
+    size_t bytes() const
+    {
+        return nodes.capacity() * sizeof(Node) + triangles.capacity() * sizeof(Triangle) +
+               (faces.capacity() + mesh_first_face.capacity()) * sizeof(uint32_t);
+    }
+
+    // Splits a face number into its mesh and its triangle in that mesh's
+    // LOD 0.
+    void locate(uint32_t face, uint32_t *mesh, uint32_t *mesh_face) const
+    {
+        size_t m = std::upper_bound(mesh_first_face.begin(), mesh_first_face.end(), face) - mesh_first_face.begin() - 1;
+        *mesh = static_cast<uint32_t>(m);
+        *mesh_face = face - mesh_first_face[m];
+    }
+
+    // The nearest front face the ray hits within (0, t_max].
+    bool intersect(const Ray &ray, RayHit *hit, float t_max = std::numeric_limits<float>::max()) const
+    {
+        hit->t = t_max;
+        hit->face = NO_FACE;
+        traverse<false>(ray, hit);
+        return hit->face != NO_FACE;
+    }
+
+    // Whether any front face lies within (0, t_max]; stops at the first one
+    // found.
+    bool occluded(const Ray &ray, float t_max) const
+    {
+        RayHit hit;
+        hit.t = t_max;
+        return traverse<true>(ray, &hit);
+    }
+
+    void build(const Model &model)
+    {
+        std::vector<Triangle> by_face = face_triangles(model);
+        size_t face_count = by_face.size();
+        std::vector<Bounds> boxes(face_count);
+        std::vector<Vec3> centroids(face_count);
+        for (size_t f = 0; f < face_count; ++f)
+        {
+            const Triangle &tri = by_face[f];
+            boxes[f].grow(tri.v0);
+            boxes[f].grow(Vec3::add(tri.v0, tri.e1));
+            boxes[f].grow(Vec3::add(tri.v0, tri.e2));
+            centroids[f] = Vec3::scale(Vec3::add(boxes[f].lo, boxes[f].hi), 0.5f);
+        }
+        faces.resize(face_count);
+        for (size_t f = 0; f < face_count; ++f)
+            faces[f] = static_cast<uint32_t>(f);
+
+        nodes.clear();
+        if (face_count > 0)
+        {
+            std::vector<BuildNode> binary;
+            binary.reserve(face_count / MAX_LEAF_TRIANGLES * 2 + 1);
+            build_binary(binary, boxes, centroids, 0, static_cast<uint32_t>(face_count), 0);
+            nodes.reserve(binary.size() / 2 + 1);
+            collapse(binary, 0);
+        }
+        triangles.resize(face_count);
+        for (size_t t = 0; t < face_count; ++t)
+            triangles[t] = by_face[faces[t]];
+    }
+
+    // Restores triangles from faces, as after loading a cached hierarchy.
+    void fill_triangles(const Model &model)
+    {
+        std::vector<Triangle> by_face = face_triangles(model);
+        triangles.resize(faces.size());
+        for (size_t t = 0; t < faces.size(); ++t)
+            triangles[t] = by_face[faces[t]];
+    }
+
+    // Every face's triangle, by face number; also numbers the meshes.
+    std::vector<Triangle> face_triangles(const Model &model)
+    {
+        std::vector<Triangle> by_face;
+        mesh_first_face.clear();
+        for (const Mesh &mesh : model.meshes)
+        {
+            mesh_first_face.push_back(static_cast<uint32_t>(by_face.size()));
+            for (size_t i = 0; i + 2 < mesh.lods[0].index_count(); i += 3)
+            {
+                Vec3 v0 = lod0_position(model, mesh, i);
+                by_face.push_back({v0, Vec3::subtract(lod0_position(model, mesh, i + 1), v0),
+                                   Vec3::subtract(lod0_position(model, mesh, i + 2), v0)});
+            }
+        }
+        mesh_first_face.push_back(static_cast<uint32_t>(by_face.size()));
+        return by_face;
+    }
+
+    struct BuildNode
+    {
+        Bounds bounds;
+        uint32_t left = 0, right = 0; // Children of an inner node
+        uint32_t first = 0, count = 0; // Faces of a leaf, which has count > 0
+    };
+
+    // Builds the subtree over faces[first, first + count) and returns its
+    // index in binary.
+    uint32_t build_binary(std::vector<BuildNode> &binary, const std::vector<Bounds> &boxes,
+                          const std::vector<Vec3> &centroids, uint32_t first, uint32_t count, int depth)
+    {
+        uint32_t index = static_cast<uint32_t>(binary.size());
+        binary.emplace_back();
+        Bounds bounds, centre_bounds;
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            bounds.grow(boxes[faces[i]]);
+            centre_bounds.grow(centroids[faces[i]]);
+        }
+        binary[index].bounds = bounds;
+
+        // Cost in triangle tests, with a node visit costing about as much
+        // as one.
+        int best_axis = -1, best_split = 0;
+        float best_cost = static_cast<float>(count);
+        Vec3 extent = Vec3::subtract(centre_bounds.hi, centre_bounds.lo);
+        const float *lo = &centre_bounds.lo.x, *size = &extent.x;
+        auto bin_of = [&](uint32_t face, int axis) {
+            int b = static_cast<int>(SAH_BINS * ((&centroids[face].x)[axis] - lo[axis]) / size[axis]);
+            return std::min(b, SAH_BINS - 1);
+        };
+        for (int axis = 0; depth < MAX_SAH_DEPTH && count > 1 && axis < 3; ++axis)
+        {
+            if (size[axis] <= 0.0f)
+                continue;
+            Bounds bin_bounds[SAH_BINS];
+            uint32_t bin_count[SAH_BINS] = {};
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                int b = bin_of(faces[i], axis);
+                bin_bounds[b].grow(boxes[faces[i]]);
+                ++bin_count[b];
+            }
+            // Sweep from the right to get each split's right-hand cost, then
+            // from the left to complete it.
+            float right_area[SAH_BINS];
+            uint32_t right_count[SAH_BINS];
+            Bounds right;
+            uint32_t n = 0;
+            for (int b = SAH_BINS - 1; b > 0; --b)
+            {
+                right.grow(bin_bounds[b]);
+                n += bin_count[b];
+                right_area[b] = right.area();
+                right_count[b] = n;
+            }
+            Bounds left;
+            n = 0;
+            float inv_area = 1.0f / std::max(bounds.area(), std::numeric_limits<float>::min());
+            for (int b = 1; b < SAH_BINS; ++b)
+            {
+                left.grow(bin_bounds[b - 1]);
+                n += bin_count[b - 1];
+                if (n == 0 || right_count[b] == 0)
+                    continue;
+                float cost = 1.0f + (left.area() * n + right_area[b] * right_count[b]) * inv_area;
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = b;
+                }
+            }
+        }
+
+        uint32_t middle;
+        if (best_axis >= 0)
+            middle = static_cast<uint32_t>(
+                std::partition(faces.begin() + first, faces.begin() + first + count,
+                               [&](uint32_t face) { return bin_of(face, best_axis) < best_split; }) -
+                faces.begin());
+        else if (count <= MAX_LEAF_TRIANGLES)
+        {
+            binary[index].first = first;
+            binary[index].count = count;
+            return index;
+        }
+        else
+        {
+            // Too many faces for a leaf but no useful split: halve them
+            // along the widest axis.
+            int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+            middle = first + count / 2;
+            std::nth_element(faces.begin() + first, faces.begin() + middle, faces.begin() + first + count,
+                             [&](uint32_t a, uint32_t b) { return (&centroids[a].x)[axis] < (&centroids[b].x)[axis]; });
+        }
+        uint32_t left = build_binary(binary, boxes, centroids, first, middle - first, depth + 1);
+        uint32_t right = build_binary(binary, boxes, centroids, middle, first + count - middle, depth + 1);
+        binary[index].left = left;
+        binary[index].right = right;
+        return index;
+    }
+
+    // Turns the binary subtree at b into a node of up to four children by
+    // repeatedly opening the largest inner child, and returns its index.
+    uint32_t collapse(const std::vector<BuildNode> &binary, uint32_t b)
+    {
+        uint32_t children[4];
+        int n = 0;
+        if (binary[b].count > 0)
+            children[n++] = b;
+        else
+        {
+            children[n++] = binary[b].left;
+            children[n++] = binary[b].right;
+        }
+        while (n < 4)
+        {
+            int widest = -1;
+            float widest_area = -1.0f;
+            for (int i = 0; i < n; ++i)
+                if (binary[children[i]].count == 0 && binary[children[i]].bounds.area() > widest_area)
+                {
+                    widest = i;
+                    widest_area = binary[children[i]].bounds.area();
+                }
+            if (widest < 0)
+                break;
+            uint32_t opened = children[widest];
+            children[widest] = binary[opened].left;
+            children[n++] = binary[opened].right;
+        }
+
+        uint32_t index = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+        Node node = {};
+        for (int i = 0; i < n; ++i)
+        {
+            const BuildNode &child = binary[children[i]];
+            node.min_x[i] = child.bounds.lo.x;
+            node.min_y[i] = child.bounds.lo.y;
+            node.min_z[i] = child.bounds.lo.z;
+            node.max_x[i] = child.bounds.hi.x;
+            node.max_y[i] = child.bounds.hi.y;
+            node.max_z[i] = child.bounds.hi.z;
+            node.occupied |= static_cast<uint8_t>(1 << i);
+            if (child.count > 0)
+            {
+                node.child[i] = LEAF | child.first;
+                node.count[i] = static_cast<uint8_t>(child.count);
+            }
+            else
+                node.child[i] = collapse(binary, children[i]);
+        }
+        nodes[index] = node;
+        return index;
+    }
+
+    // Slab tests of a ray against a node's four child boxes. Returns a bit
+    // per child the ray enters within [0, t_max], and the entry distances.
+    static int hit_children(const Node &node, const Vec3 &origin, const Vec3 &inv_dir, float t_max, float *entry)
+    {
+#if defined(__SSE2__)
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_x), _mm_set1_ps(origin.x)), _mm_set1_ps(inv_dir.x));
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_x), _mm_set1_ps(origin.x)), _mm_set1_ps(inv_dir.x));
+        __m128 near_t = _mm_max_ps(_mm_min_ps(t0, t1), _mm_setzero_ps());
+        __m128 far_t = _mm_min_ps(_mm_max_ps(t0, t1), _mm_set1_ps(t_max));
+        t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_y), _mm_set1_ps(origin.y)), _mm_set1_ps(inv_dir.y));
+        t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_y), _mm_set1_ps(origin.y)), _mm_set1_ps(inv_dir.y));
+        near_t = _mm_max_ps(near_t, _mm_min_ps(t0, t1));
+        far_t = _mm_min_ps(far_t, _mm_max_ps(t0, t1));
+        t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_z), _mm_set1_ps(origin.z)), _mm_set1_ps(inv_dir.z));
+        t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_z), _mm_set1_ps(origin.z)), _mm_set1_ps(inv_dir.z));
+        near_t = _mm_max_ps(near_t, _mm_min_ps(t0, t1));
+        far_t = _mm_min_ps(far_t, _mm_max_ps(t0, t1));
+        _mm_storeu_ps(entry, near_t);
+        return _mm_movemask_ps(_mm_cmple_ps(near_t, far_t)) & node.occupied;
+#else
+        int mask = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            float tx0 = (node.min_x[i] - origin.x) * inv_dir.x, tx1 = (node.max_x[i] - origin.x) * inv_dir.x;
+            float ty0 = (node.min_y[i] - origin.y) * inv_dir.y, ty1 = (node.max_y[i] - origin.y) * inv_dir.y;
+            float tz0 = (node.min_z[i] - origin.z) * inv_dir.z, tz1 = (node.max_z[i] - origin.z) * inv_dir.z;
+            entry[i] = std::max({0.0f, std::min(tx0, tx1), std::min(ty0, ty1), std::min(tz0, tz1)});
+            float exit = std::min({t_max, std::max(tx0, tx1), std::max(ty0, ty1), std::max(tz0, tz1)});
+            mask |= (entry[i] <= exit) << i;
+        }
+        return mask & node.occupied;
+#endif
+    }
+
+    // Moller-Trumbore, front faces only (wound counter-clockwise towards
+    // the ray's origin, as the rasterizer keeps them).
+    static bool hit_triangle(const Triangle &tri, const Ray &ray, float t_max, float *t, float *u, float *v)
+    {
+        Vec3 p = Vec3::cross(ray.direction, tri.e2);
+        float det = Vec3::dot(tri.e1, p);
+        if (det <= 0.0f)
+            return false;
+        Vec3 s = Vec3::subtract(ray.origin, tri.v0);
+        float a = Vec3::dot(s, p);
+        if (a < 0.0f || a > det)
+            return false;
+        Vec3 q = Vec3::cross(s, tri.e1);
+        float b = Vec3::dot(ray.direction, q);
+        if (b < 0.0f || a + b > det)
+            return false;
+        float inv_det = 1.0f / det;
+        float distance = Vec3::dot(tri.e2, q) * inv_det;
+        if (distance <= 0.0f || distance > t_max)
+            return false;
+        *t = distance;
+        *u = a * inv_det;
+        *v = b * inv_det;
+        return true;
+    }
+
+    // Visits children nearest first and skips any that start beyond the
+    // nearest hit so far. With AnyHit, returns at the first hit.
+    template <bool AnyHit>
+    bool traverse(const Ray &ray, RayHit *hit) const
+    {
+        if (nodes.empty())
+            return false;
+        // A zero direction component would make 0 * inf slab distances.
+        auto inverse = [](float d) { return 1.0f / (std::abs(d) > 1e-30f ? d : std::copysign(1e-30f, d)); };
+        Vec3 inv_dir = {inverse(ray.direction.x), inverse(ray.direction.y), inverse(ray.direction.z)};
+        uint32_t stack[STACK_SIZE];
+        float stack_entry[STACK_SIZE];
+        int top = 0;
+        stack[top] = 0;
+        stack_entry[top++] = 0.0f;
+        while (top > 0)
+        {
+            --top;
+            if (stack_entry[top] > hit->t)
+                continue;
+            const Node &node = nodes[stack[top]];
+            float entry[4];
+            int mask = hit_children(node, ray.origin, inv_dir, hit->t, entry);
+
+            int order[4], n = 0;
+            for (int i = 0; i < 4; ++i)
+                if (mask & (1 << i))
+                {
+                    int j = n++;
+                    for (; j > 0 && entry[order[j - 1]] > entry[i]; --j)
+                        order[j] = order[j - 1];
+                    order[j] = i;
+                }
+            // Leaves are tested at once, nearest first; inner children are
+            // pushed farthest first so the nearest is popped next.
+            for (int k = 0; k < n; ++k)
+            {
+                int i = order[k];
+                if (!(node.child[i] & LEAF) || entry[i] > hit->t)
+                    continue;
+                uint32_t first = node.child[i] & ~LEAF;
+                for (uint32_t t = first; t < first + node.count[i]; ++t)
+                {
+                    float distance, u, v;
+                    if (!hit_triangle(triangles[t], ray, hit->t, &distance, &u, &v))
+                        continue;
+                    hit->t = distance;
+                    hit->u = u;
+                    hit->v = v;
+                    hit->face = faces[t];
+                    if (AnyHit)
+                        return true;
+                }
+            }
+            for (int k = n - 1; k >= 0; --k)
+            {
+                int i = order[k];
+                if (node.child[i] & LEAF)
+                    continue;
+                assert(top < STACK_SIZE && "tree deeper than MAX_DEPTH");
+                stack[top] = node.child[i];
+                stack_entry[top++] = entry[i];
+            }
+        }
+        return hit->face != NO_FACE;
+    }
+};
+
+// Hierarchies are cached next to the OBJ as "<obj>.bvh", keyed like LOD
+// chains. Only the nodes and the leaf order of faces are stored; triangles
+// are rebuilt from the model.
+const uint32_t BVH_CACHE_MAGIC = 0x48564241; // "ABVH"
+const uint32_t BVH_CACHE_VERSION = 1;
+
+bool load_bvh_cache(const std::string &cache_path, const FileStamp &stamp, const Model &model, Bvh *bvh)
+{
+    std::ifstream in(cache_path, std::ios::binary);
+    uint32_t magic, version, mesh_count, node_count, face_count;
+    FileStamp cached;
+    if (!read_pod(in, &magic) || !read_pod(in, &version) || !read_pod(in, &cached.size) ||
+        !read_pod(in, &cached.mtime) || !read_pod(in, &mesh_count))
+        return false;
+    if (magic != BVH_CACHE_MAGIC || version != BVH_CACHE_VERSION || cached.size != stamp.size ||
+        cached.mtime != stamp.mtime || mesh_count != model.meshes.size())
+        return false;
+    uint32_t total = 0;
+    for (const Mesh &mesh : model.meshes)
+    {
+        uint32_t faces;
+        if (!read_pod(in, &faces) || faces != mesh.lods[0].index_count() / 3)
+            return false;
+        total += faces;
+    }
+    if (!read_pod(in, &node_count) || !read_pod(in, &face_count) || face_count != total ||
+        (node_count == 0) != (face_count == 0))
+        return false;
+    std::vector<Bvh::Node> nodes(node_count);
+    std::vector<uint32_t> faces(face_count);
+    if (!in.read(reinterpret_cast<char *>(nodes.data()), node_count * sizeof(Bvh::Node)) ||
+        !in.read(reinterpret_cast<char *>(faces.data()), face_count * sizeof(uint32_t)))
+        return false;
+    // Nodes follow their parents, as build() emits them, and stay within
+    // the depth the traversal stack is sized for.
+    std::vector<uint8_t> depth(node_count, 0);
+    for (uint32_t n = 0; n < node_count; ++n)
+    {
+        const Bvh::Node &node = nodes[n];
+        for (int i = 0; i < 4; ++i)
+        {
+            if (!(node.occupied & (1 << i)))
+                continue;
+            uint32_t child = node.child[i] & ~Bvh::LEAF;
+            if (node.child[i] & Bvh::LEAF)
+            {
+                if (child + node.count[i] > face_count)
+                    return false;
+                continue;
+            }
+            if (child <= n || child >= node_count || depth[n] >= Bvh::MAX_DEPTH)
+                return false;
+            depth[child] = static_cast<uint8_t>(depth[n] + 1);
+        }
+    }
+    for (uint32_t face : faces)
+        if (face >= face_count)
+            return false;
+    bvh->nodes.swap(nodes);
+    bvh->faces.swap(faces);
+    bvh->fill_triangles(model);
+    return true;
+}
+
+// Best effort, like save_lod_cache().
+void save_bvh_cache(const std::string &cache_path, const FileStamp &stamp, const Model &model, const Bvh &bvh)
+{
+    std::ofstream out(cache_path, std::ios::binary);
+    if (!out)
+        return;
+    write_pod(out, BVH_CACHE_MAGIC);
+    write_pod(out, BVH_CACHE_VERSION);
+    write_pod(out, stamp.size);
+    write_pod(out, stamp.mtime);
+    write_pod(out, static_cast<uint32_t>(model.meshes.size()));
+    for (const Mesh &mesh : model.meshes)
+        write_pod(out, static_cast<uint32_t>(mesh.lods[0].index_count() / 3));
+    write_pod(out, static_cast<uint32_t>(bvh.nodes.size()));
+    write_pod(out, static_cast<uint32_t>(bvh.faces.size()));
+    out.write(reinterpret_cast<const char *>(bvh.nodes.data()), bvh.nodes.size() * sizeof(Bvh::Node));
+    out.write(reinterpret_cast<const char *>(bvh.faces.data()), bvh.faces.size() * sizeof(uint32_t));
+}
+
+// Loads the model's hierarchy from its cache next to the OBJ at path, or
+// builds and caches it. cached reports which happened.
+void load_bvh(const std::string &path, const Model &model, Bvh *bvh, bool *cached)
+{
+    FileStamp stamp;
+    std::string cache_path = path + ".bvh";
+    bool have_stamp = stat_file(path, &stamp);
+    *cached = have_stamp && load_bvh_cache(cache_path, stamp, model, bvh);
+    if (*cached)
+        return;
+    bvh->build(model);
+    if (have_stamp)
+        save_bvh_cache(cache_path, stamp, model, *bvh);
+}
+
+// --- Thread Pool ---
+
+// One unit of work in a JobGraph. A job with no run function is a barrier
+// that only exists to fan dependencies in and out.
+struct Job
+{
+    void (*run)(void *context, size_t index);
+    void *context;
+    size_t index;
+    const char *stage; // Label that timings are aggregated under
+    uint32_t dependencies;
+    uint32_t first_successor, successor_count;
+    double start_ms, end_ms; // Relative to the start of ThreadPool::run
+};
+
+// A per-frame DAG of jobs. It is rebuilt every frame, but clear() keeps the
+// vectors' capacity so steady-state frames do not allocate.
+class JobGraph
+{
+public:
+    void clear()
+    {
+        jobs.clear();
+        links.clear();
+    }
+
+    uint32_t add(const char *stage, void (*run)(void *, size_t), void *context, size_t index = 0)
+    {
+        jobs.push_back({run, context, index, stage, 0, 0, 0, 0.0, 0.0});
+        return static_cast<uint32_t>(jobs.size() - 1);
+    }
+
+    // `after` may not start until `before` has finished.
+    void depend(uint32_t before, uint32_t after)
+    {
+        links.push_back({before, after});
+        ++jobs[after].dependencies;
+    }
+
+    size_t size() const { return jobs.size(); }
+    const Job &job(size_t i) const { return jobs[i]; }
+
+private:
+    friend class ThreadPool;
+
+    // Groups links by predecessor so each job can find its successors.
+    void finalize()
+    {
+        for (Job &job : jobs)
+            job.successor_count = 0;
+        for (const auto &link : links)
+            ++jobs[link.first].successor_count;
+        uint32_t offset = 0;
+        for (Job &job : jobs)
+        {
+            job.first_successor = offset;
+            offset += job.successor_count;
+            job.successor_count = 0;
+        }
+        successors.resize(links.size());
+        for (const auto &link : links)
+        {
+            Job &job = jobs[link.first];
+            successors[job.first_successor + job.successor_count++] = link.second;
+        }
+    }
+
+    std::vector<Job> jobs;
+    std::vector<std::pair<uint32_t, uint32_t>> links;
+    std::vector<uint32_t> successors;
+};
+
+// Persistent work-stealing pool. Each worker owns a ring-buffer deque: it
+// pops its own newest job and steals the oldest job from others when idle.
+// The thread calling run() acts as worker 0, so a pool of one thread runs
+// the graph inline. Pinning is only supported on Linux.
+class ThreadPool
+{
+public:
+    ThreadPool(int thread_count, bool pin_threads)
+    {
+        thread_count = std::max(1, thread_count);
+        for (int i = 0; i < thread_count; ++i)
+            queues.emplace_back(new Queue());
+        for (int i = 1; i < thread_count; ++i)
+        {
+            threads.emplace_back(&ThreadPool::worker_main, this, i);
+#ifdef __linux__
+            if (pin_threads)
+            {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(i % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+                pthread_setaffinity_np(threads.back().native_handle(), sizeof(cpus), &cpus);
+            }
+#endif
+        }
+#ifdef __linux__
+        if (pin_threads)
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(0, &cpus);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        }
+#else
+        (void)pin_threads;
+#endif
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(wake_lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &t : threads)
+            t.join();
+    }
+
+    int size() const { return static_cast<int>(queues.size()); }
+
+    // Runs every job in the graph and returns once all have finished.
+    void run(JobGraph &jobs)
+    {
+        start(jobs);
+        wait();
+    }
+
+    // Queues the graph's root jobs and returns immediately; the workers
+    // make progress on it until wait() is called. The graph must stay alive
+    // and untouched until then.
+    void start(JobGraph &jobs)
+    {
+        assert(!graph && "a graph is already running");
+        if (jobs.size() == 0)
+            return;
+        jobs.finalize();
+        if (pending_capacity < jobs.size())
+        {
+            pending.reset(new std::atomic<uint32_t>[jobs.size()]);
+            pending_capacity = jobs.size();
+            // A job is queued once per run, so no queue can hold more than
+            // the whole graph. Between runs every queue is empty.
+            for (std::unique_ptr<Queue> &q : queues)
+            {
+                std::lock_guard<std::mutex> lock(q->lock);
+                q->items.reset(new uint32_t[jobs.size()]);
+                q->capacity = jobs.size();
+                q->head = q->tail = 0;
+            }
+        }
+        for (size_t i = 0; i < jobs.size(); ++i)
+            pending[i].store(jobs.jobs[i].dependencies, std::memory_order_relaxed);
+
+        graph = &jobs;
+        epoch = std::chrono::steady_clock::now();
+        remaining.store(jobs.size(), std::memory_order_release);
+        for (size_t i = 0; i < jobs.size(); ++i)
+            if (jobs.jobs[i].dependencies == 0)
+                push(static_cast<int>(i % queues.size()), static_cast<uint32_t>(i));
+    }
+
+    // Helps run the started graph until every job has finished.
+    void wait()
+    {
+        while (remaining.load(std::memory_order_acquire) > 0)
+        {
+            uint32_t job;
+            if (pop(0, &job))
+                execute(0, job);
+            else
+                std::this_thread::yield();
+        }
+        graph = nullptr;
+    }
+
+private:
+    // A ring sized by start() for the largest graph run so far.
+    struct Queue
+    {
+        std::mutex lock;
+        std::unique_ptr<uint32_t[]> items;
+        size_t capacity = 0;
+        size_t head = 0, tail = 0; // Oldest at head, newest at tail - 1
+    };
+
+    void push(int worker, uint32_t job)
+    {
+        Queue &q = *queues[worker];
+        {
+            std::lock_guard<std::mutex> lock(q.lock);
+            q.items[q.tail++ % q.capacity] = job;
+        }
+        ready.fetch_add(1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(wake_lock);
+        }
+        wake.notify_one();
+    }
+
+    bool pop(int worker, uint32_t *job)
+    {
+        for (size_t i = 0; i < queues.size(); ++i)
+        {
+            Queue &q = *queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(q.lock);
+            if (q.head == q.tail)
+                continue;
+            *job = i == 0 ? q.items[--q.tail % q.capacity] : q.items[q.head++ % q.capacity];
+            ready.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    double elapsed_ms() const
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    void execute(int worker, uint32_t index)
+    {
+        Job &job = graph->jobs[index];
+        job.start_ms = elapsed_ms();
+        if (job.run)
+            job.run(job.context, job.index);
+        job.end_ms = elapsed_ms();
+        for (uint32_t s = 0; s < job.successor_count; ++s)
+        {
+            uint32_t next = graph->successors[job.first_successor + s];
+            if (pending[next].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                push(worker, next);
+        }
+        remaining.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    void worker_main(int worker)
+    {
+        AllocationTracking tracking;
+        for (;;)
+        {
+            uint32_t job;
+            if (pop(worker, &job))
+            {
+                execute(worker, job);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(wake_lock);
+            wake.wait(lock, [&] { return stopping || ready.load(std::memory_order_acquire) > 0; });
+            if (stopping)
+                return;
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex wake_lock;
+    std::condition_variable wake;
+    bool stopping = false;
+    JobGraph *graph = nullptr;
+    std::unique_ptr<std::atomic<uint32_t>[]> pending;
+    size_t pending_capacity = 0;
+    std::atomic<size_t> remaining{0};
+    std::atomic<size_t> ready{0};
+    std::chrono::steady_clock::time_point epoch;
+};
+
+// --- Renderer ---
+
+// Everything draw() needs to know about the viewpoint for one frame.
+// Culling and lighting happen in model space, so camera_pos and
+// light_direction are given there.
+struct FrameView
+{
+    Mat4 model_matrix, view_matrix, projection_matrix;
+    Vec3 camera_pos;
+    Vec3 light_direction;
+};
+
+// The model-space ray through grid position (x, y), in cells, of a
+// width x height frame whose model-view-projection matrix inverts to
+// inverse_mvp. It runs from the near plane (t = 0) to the far plane (t = 1).
+Ray cell_ray(const Mat4 &inverse_mvp, float x, float y, int width, int height)
+{
+    float ndc_x = 2.0f * x / width - 1.0f, ndc_y = 1.0f - 2.0f * y / height;
+    Vec4 near_point = inverse_mvp.transform({ndc_x, ndc_y, -1.0f, 1.0f});
+    Vec4 far_point = inverse_mvp.transform({ndc_x, ndc_y, 1.0f, 1.0f});
+    Vec3 origin = {near_point.x / near_point.w, near_point.y / near_point.w, near_point.z / near_point.w};
+    Vec3 end = {far_point.x / far_point.w, far_point.y / far_point.w, far_point.z / far_point.w};
+    return {origin, Vec3::subtract(end, origin)};
+}
+
+// Reports the face shown at cell (x, y) of a frame drawn with view.
+void print_pick(const Bvh &bvh, const Model &model, const FrameView &view, int width, int height, int x, int y)
+{
+    Mat4 mvp = Mat4::multiply(view.projection_matrix, Mat4::multiply(view.view_matrix, view.model_matrix));
+    Ray ray = cell_ray(Mat4::inverse(mvp), x + 0.5f, y + 0.5f, width, height);
+    RayHit hit;
+    std::cerr << "pick " << x << "," << y << ": ";
+    if (!bvh.intersect(ray, &hit, 1.0f))
+    {
+        std::cerr << "nothing\n";
+        return;
+    }
+    uint32_t mesh, face;
+    bvh.locate(hit.face, &mesh, &face);
+    Vec3 point = Vec3::add(ray.origin, Vec3::scale(ray.direction, hit.t));
+    std::cerr << "mesh " << mesh << " face " << face << " material " << model.meshes[mesh].material << " at ("
+              << point.x << ", " << point.y << ", " << point.z << ")\n";
+}
+
+// Screen positions are snapped to fixed point with SUBPIXEL_BITS of
+// fraction, so edge functions are exact integer math and a shared edge is
+// owned by exactly one of its two triangles (see AsciiRenderer::owns_edge).
+const int SUBPIXEL_BITS = 8;
+const int SUBPIXEL_ONE = 1 << SUBPIXEL_BITS;
+// Snapped coordinates must stay within this many cells of the origin so
+// edge function products fit comfortably in 64 bits.
+const float GUARD_BAND_CELLS = 32768.0f;
+
+// A vertex after projection and snapping; shared by every triangle that
+// uses it within a frame.
+struct ProjectedVertex
+{
+    int32_t x, y;
+    float inv_w;
+    bool visible; // False behind the camera or outside the guard band
+};
+
+// A triangle after culling, lighting and projection, ready for rasterization.
+// Vertices are wound so that the edge functions are positive inside.
+struct ScreenTriangle
+{
+    int32_t x[3], y[3];
+    float inv_w[3];
+    char glyph;
+    uint16_t color; // RGB565 shaded material colour
+};
+
+// Texturing for the ScreenTriangle at the same index, kept in a separate
+// array that only textured models pay for. Texture coordinates are in
+// texels of the triangle's mip level and premultiplied by 1/w, so they
+// interpolate linearly in screen space; dividing by the interpolated 1/w
+// makes them perspective-correct. The cell's glyph is the ramp entry for
+// intensity times the sampled luminance.
+struct TriangleTexture
+{
+    const LuminanceTexture::Level *level; // Null for an untextured triangle
+    float u[3], v[3];
+    float intensity;
+    const std::string *ramp;
+};
+
+// Wall-clock time spent in one stage of the frame's job graph.
+struct StageTiming
+{
+    const char *stage;
+    size_t jobs;
+    double busy_ms; // Summed over the stage's jobs
+    double span_ms; // First start to last finish
+};
+
+// Per-frame instrumentation counters, reset at the start of every draw().
+// Jobs count into their own copy and draw() merges them once the graph has
+// run.
+struct FrameStats
+{
+    size_t triangles_submitted = 0;
+    size_t lod_triangles_skipped = 0;
+    size_t vertices_transformed = 0;
+    size_t triangles_culled = 0;
+    // Triangles that reached the rasterizer, by how many cell centres their
+    // bounding box contains: none, exactly one, or more.
+    size_t triangles_empty = 0;
+    size_t triangles_single_cell = 0;
+    size_t triangles_large = 0;
+    size_t triangles_textured = 0; // Always take the large path, which samples per cell
+    size_t hiz_triangles_rejected = 0; // Counted once per bin a triangle touches
+    size_t hiz_tiles_rejected = 0;
+    size_t depth_tests = 0;
+    size_t depth_writes = 0;
+    size_t cells_covered = 0;
+    size_t grid_cells = 0;
+    // Face cache lookups, one per mesh LOD drawn; see AsciiRenderer::FaceCache.
+    size_t plane_cache_hits = 0;
+    size_t plane_cache_misses = 0;
+    size_t shading_cache_hits = 0;
+    size_t shading_cache_misses = 0;
+    // Temporal reuse; see AsciiRenderer::reproject_bin().
+    size_t tiles_reused = 0;
+    size_t cells_reused = 0;
+    // Ray casting; see AsciiRenderer::trace_bin().
+    size_t rays_cast = 0;
+    size_t ray_hits = 0;
+
+    static const int MAX_STAGES = 8;
+    StageTiming stages[MAX_STAGES];
+    int stage_count = 0;
+    double frame_ms = 0.0;
+    double render_ms = 0.0; // First job start to last job finish
+
+    // Depth writes per covered cell; 1.0 means nothing was drawn twice.
+    float overdraw() const { return cells_covered ? static_cast<float>(depth_writes) / cells_covered : 0.0f; }
+
+    void merge(const FrameStats &other)
+    {
+        triangles_submitted += other.triangles_submitted;
+        lod_triangles_skipped += other.lod_triangles_skipped;
+        vertices_transformed += other.vertices_transformed;
+        triangles_culled += other.triangles_culled;
+        triangles_empty += other.triangles_empty;
+        triangles_single_cell += other.triangles_single_cell;
+        triangles_large += other.triangles_large;
+        triangles_textured += other.triangles_textured;
+        hiz_triangles_rejected += other.hiz_triangles_rejected;
+        hiz_tiles_rejected += other.hiz_tiles_rejected;
+        depth_tests += other.depth_tests;
+        depth_writes += other.depth_writes;
+        cells_covered += other.cells_covered;
+        plane_cache_hits += other.plane_cache_hits;
+        plane_cache_misses += other.plane_cache_misses;
+        shading_cache_hits += other.shading_cache_hits;
+        shading_cache_misses += other.shading_cache_misses;
+        tiles_reused += other.tiles_reused;
+        cells_reused += other.cells_reused;
+        rays_cast += other.rays_cast;
+        ray_hits += other.ray_hits;
+    }
+
+    // Folds the per-job timings of a finished graph into per-stage totals.
+    // Jobs without a stage label (barriers) are skipped.
+    void add_timings(const JobGraph &graph)
+    {
+        double start[MAX_STAGES], end[MAX_STAGES];
+        for (size_t i = 0; i < graph.size(); ++i)
+        {
+            const Job &job = graph.job(i);
+            if (!job.stage)
+                continue;
+            int s = 0;
+            while (s < stage_count && std::strcmp(stages[s].stage, job.stage) != 0)
+                ++s;
+            if (s == MAX_STAGES)
+                continue;
+            if (s == stage_count)
+            {
+                stages[stage_count++] = {job.stage, 0, 0.0, 0.0};
+                start[s] = job.start_ms;
+                end[s] = job.end_ms;
+            }
+            ++stages[s].jobs;
+            stages[s].busy_ms += job.end_ms - job.start_ms;
+            start[s] = std::min(start[s], job.start_ms);
+            end[s] = std::max(end[s], job.end_ms);
+        }
+        double first = 0.0, last = 0.0;
+        for (int s = 0; s < stage_count; ++s)
+        {
+            stages[s].span_ms = end[s] - start[s];
+            first = s == 0 ? start[s] : std::min(first, start[s]);
+            last = s == 0 ? end[s] : std::max(last, end[s]);
+        }
+        render_ms = last - first;
+    }
+};
+
+void print_stats(const FrameStats &stats)
+{
+    std::cerr << "tris " << stats.triangles_submitted
+              << " lod skipped " << stats.lod_triangles_skipped
+              << " verts " << stats.vertices_transformed
+              << " culled " << stats.triangles_culled
+              << " | empty " << stats.triangles_empty
+              << " single " << stats.triangles_single_cell
+              << " large " << stats.triangles_large
+              << " textured " << stats.triangles_textured
+              << " | hiz tris " << stats.hiz_triangles_rejected
+              << " tiles " << stats.hiz_tiles_rejected
+              << " | depth tests " << stats.depth_tests
+              << " writes " << stats.depth_writes
+              << " overdraw " << stats.overdraw()
+              << " | cache planes " << stats.plane_cache_hits << "/"
+              << stats.plane_cache_hits + stats.plane_cache_misses
+              << " shading " << stats.shading_cache_hits << "/"
+              << stats.shading_cache_hits + stats.shading_cache_misses
+              << " | reused cells " << stats.cells_reused << " ("
+              << (stats.grid_cells ? 100.0 * stats.cells_reused / stats.grid_cells : 0.0) << "% of grid)"
+              << " tiles " << stats.tiles_reused
+              << " | rays " << stats.rays_cast << " hits " << stats.ray_hits << "\n";
+    if (stats.stage_count == 0)
+        return;
+    std::cerr << "  frame " << stats.frame_ms << "ms render " << stats.render_ms << "ms";
+    for (int s = 0; s < stats.stage_count; ++s)
+        std::cerr << " | " << stats.stages[s].stage << " x" << stats.stages[s].jobs
+                  << " busy " << stats.stages[s].busy_ms << "ms span " << stats.stages[s].span_ms << "ms";
+    std::cerr << "\n";
+}
+
+// How AsciiRenderer fills a frame: by rasterizing the mesh, by casting a
+// ray per cell through its Bvh, or whichever suits the frame.
+enum class RenderPath
+{
+    Auto,
+    Raster,
+    RayCast
+};
+
+bool parse_render_path(const std::string &name, RenderPath *path)
+{
+    if (name == "auto")
+        *path = RenderPath::Auto;
+    else if (name == "raster")
+        *path = RenderPath::Raster;
+    else if (name == "ray")
+        *path = RenderPath::RayCast;
+    else
+    {
+        std::cerr << "Unknown render path: " << name << " (expected auto, raster or ray)" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Owns the character grid and everything needed to fill it for one frame.
+struct AsciiRenderer
+{
+    // Hierarchical Z: each HIZ_TILE x HIZ_TILE block of cells keeps the
+    // farthest (smallest 1/w) and nearest (largest 1/w) depth it contains.
+    // Depth only ever increases within a frame, so a stale far value is still
+    // a conservative bound; it is refreshed lazily, and only for triangles
+    // large enough to amortise the rescan.
+    static const int HIZ_TILE = 8;
+    static const int HIZ_REFRESH_MIN_CELLS = 16;
+
+    // Each frame runs as a job graph on the thread pool:
+    //   transform (vertex chunks) -> setup (triangle chunks) -> bin ->
+    //   raster (one per screen bin) -> resolve (one per screen bin).
+    // With temporal reuse, reproject (one per screen bin) -> classify also
+    // runs from the start and gates the bin stage. A ray cast frame is just
+    // trace (one per screen bin) -> resolve.
+    // Jobs never share output: chunks write disjoint ranges and bins are
+    // whole HiZ tiles, so a raster job owns its cells and tiles outright.
+    static const int BIN_WIDTH = 32;
+    static const int BIN_HEIGHT = 16;
+    static const size_t TRANSFORM_CHUNK = 16384;
+    static const size_t SETUP_CHUNK = 4096;
+    static_assert(BIN_WIDTH % HIZ_TILE == 0 && BIN_HEIGHT % HIZ_TILE == 0, "bins must be whole HiZ tiles");
+
+    // A non-blank cell produced by the resolve stage.
+    struct GlyphCell
+    {
+        uint16_t x, y;
+        char glyph;
+        uint16_t color;
+    };
+
+    struct TransformChunk;
+    struct SetupChunk;
+    struct Bin;
+
+    // Per-face data that stays valid while only the model matrix changes.
+    // Culling and lighting both happen in model space, so a face's plane
+    // depends on the mesh alone, and its flat shading also on the light
+    // direction and ramp. Arrays are sized for every LOD when a model is
+    // first drawn, so later frames never allocate, and each LOD is filled
+    // by the setup jobs of the first frame that draws it.
+    struct FacePlane
+    {
+        Vec3 normal; // Unnormalized
+        float d;     // dot(normal, first vertex)
+    };
+    struct FaceShading
+    {
+        float intensity;
+        uint16_t color;
+        char glyph;
+    };
+    struct FaceCache
+    {
+        uint64_t model_id = 0;
+        Vec3 light_direction;
+        std::string ramp;
+        std::vector<size_t> first_lod;  // Per mesh, its LOD 0's slot in the per-LOD arrays
+        std::vector<size_t> first_face; // Per LOD slot, its offset into planes and shading
+        std::vector<unsigned char> planes_ready, shading_ready; // Per LOD slot
+        std::vector<FacePlane> planes;
+        std::vector<FaceShading> shading;
+    };
+
+    int width, height;
+    std::vector<float> depth_buffer;
+    std::vector<char> char_buffer;
+    std::vector<uint16_t> color_buffer; // RGB565 per cell; only meaningful where char_buffer isn't blank
+    int tiles_x, tiles_y;
+    std::vector<float> tile_far;
+    std::vector<float> tile_near;
+    std::vector<unsigned char> tile_dirty;
+    int bins_x, bins_y;
+    // Not thread-safe. While a frame's graph runs, the arena belongs to its
+    // single bin job, which runs alone: every other job either precedes it
+    // in the graph or waits on it. No other job may allocate from it.
+    FrameArena arena;
+    FrameStats stats;
+    bool sort_front_to_back = true;
+    bool use_lods = true;
+    bool cache_faces = true; // See FaceCache
+    FaceCache face_cache;
+
+    // Temporal reuse, on when temporal_refresh > 0: a cell whose last frame
+    // still holds after reprojection keeps its glyph instead of being
+    // rasterized, and every temporal_refresh-th frame is drawn in full to
+    // bound the error that builds up. The depth buffer, which outlives its
+    // frame, is the history; see reproject_bin().
+    struct CellSample
+    {
+        float x, y; // Screen position, in cells, of the surface point a reused cell shows
+        float inv_w;
+    };
+    static constexpr float MAX_SAMPLE_DRIFT = 0.5f; // Cells from the cell centre
+    static constexpr float MAX_DEPTH_STEP = 0.02f;  // Relative 1/w step to a neighbouring cell
+    int temporal_refresh = 0;
+    std::vector<CellSample> reprojected; // Per cell; last frame's sample moved into this one
+    std::vector<unsigned char> cell_stable, cell_reused;
+    std::vector<unsigned char> tile_reused; // Every cell of the HiZ tile is reused
+    bool history_valid = false;
+    int frames_since_refresh = 0;
+    uint64_t history_model = 0;
+    Vec3 history_light;
+    std::string history_ramp;
+    Mat4 history_mvp;
+    // Ray casting: given a Bvh, a frame can cast one ray per cell instead,
+    // at a cost that follows the cell count rather than the triangle count.
+    // RenderPath::Auto does so once the selected LODs have more than
+    // ray_cast_ratio triangles per cell.
+    static constexpr float RAY_CAST_RATIO = 4.0f;
+    RenderPath render_path = RenderPath::Auto;
+    float ray_cast_ratio = RAY_CAST_RATIO;
+    // For run_self_test(): when set, each cell counts the triangles covering
+    // its centre, before the depth test and with hierarchical Z off.
+    uint16_t *coverage_counts = nullptr;
+    float lod_error_cells = 1.0f;
+    std::string ramp = DEFAULT_RAMP; // Glyphs from dark to light; ' ' is treated as empty
+    std::unique_ptr<ThreadPool> pool;
+    JobGraph graph;
+
+    // Frames are double-buffered so one can be presented while the next is
+    // drawn: begin_draw() moves the last finished frame's grid, arena (which
+    // owns its glyph lists), bins and stats to the front_ members and draws
+    // into the other set.
+    std::vector<char> front_char_buffer;
+    std::vector<uint16_t> front_color_buffer;
+    FrameArena front_arena;
+    Bin *front_bins = nullptr;
+    int front_width = 0, front_height = 0, front_bin_count = 0;
+    FrameStats front_stats;
+    bool drawing = false;
+    int pending_width, pending_height; // Applied by the next begin_draw(); see resize()
+    std::chrono::steady_clock::time_point frame_start;
+
+    // State shared with the current frame's jobs, carved from the arena in
+    // begin_draw() before the graph starts; only the bin job allocates
+    // afterwards (see arena).
+    const Model *frame_model = nullptr;
+    FrameView frame_view;
+    Mat4 frame_mvp;
+    const Bvh *frame_bvh = nullptr; // Set for ray cast frames
+    Mat4 frame_inverse_mvp;
+    bool frame_reuses_history = false;
+    bool history_moved = false; // The last frame reused cells, whose samples are off-centre
+    Mat4 frame_reprojection; // Last frame's clip space to this frame's
+    float history_z_scale = 0.0f, history_z_offset = 0.0f; // Last frame's clip z from its w
+    ProjectedVertex *projected = nullptr;
+    TransformChunk *transform_chunks = nullptr;
+    ScreenTriangle *triangles = nullptr;
+    TriangleTexture *triangle_textures = nullptr; // Parallel to triangles; null unless the model is textured
+    size_t triangle_count = 0;
+    SetupChunk *setup_chunks = nullptr;
+    size_t setup_chunk_count = 0;
+    Bin *bins = nullptr;
+
+    AsciiRenderer(int w, int h, int threads = 1, bool pin_threads = false)
+        : pool(new ThreadPool(threads, pin_threads)), front_char_buffer(w * h, ' '), front_color_buffer(w * h, 0),
+          pending_width(w), pending_height(h)
+    {
+        allocate_grid(w, h);
+    }
+
+    // Changes the grid size from the next begin_draw() on. The most recently
+    // finished frame keeps its old size, so it can still be presented while
+    // the first frame at the new size is drawn; its grid is resized when it
+    // is swapped back in the frame after.
+    void resize(int w, int h)
+    {
+        pending_width = w;
+        pending_height = h;
+    }
+
+    void allocate_grid(int w, int h)
+    {
+        width = w;
+        height = h;
+        depth_buffer.assign(w * h, 0.0f);
+        char_buffer.assign(w * h, ' ');
+        color_buffer.assign(w * h, 0);
+        tiles_x = (w + HIZ_TILE - 1) / HIZ_TILE;
+        tiles_y = (h + HIZ_TILE - 1) / HIZ_TILE;
+        tile_far.assign(tiles_x * tiles_y, 0.0f);
+        tile_near.assign(tiles_x * tiles_y, 0.0f);
+        tile_dirty.assign(tiles_x * tiles_y, 0);
+        bins_x = (w + BIN_WIDTH - 1) / BIN_WIDTH;
+        bins_y = (h + BIN_HEIGHT - 1) / BIN_HEIGHT;
+        history_valid = false;
+    }
+
+    // Grid and stats of the most recently finished frame.
+    const std::vector<char> &finished_char_buffer() const { return drawing ? front_char_buffer : char_buffer; }
+    const std::vector<uint16_t> &finished_color_buffer() const { return drawing ? front_color_buffer : color_buffer; }
+    int finished_width() const { return drawing ? front_width : width; }
+    int finished_height() const { return drawing ? front_height : height; }
+    const FrameStats &finished_stats() const { return drawing ? front_stats : stats; }
+
+    // Calls visit(x, y, glyph, color) for every non-blank cell of the most
+    // recently finished frame. Safe to call while the next frame is being
+    // drawn.
+    template <typename Visit>
+    void for_each_glyph(Visit visit) const
+    {
+        const Bin *finished = drawing ? front_bins : bins;
+        if (!finished)
+            return;
+        int bin_count = drawing ? front_bin_count : bins_x * bins_y;
+        for (int b = 0; b < bin_count; ++b)
+            for (size_t i = 0; i < finished[b].glyph_count; ++i)
+            {
+                const GlyphCell &cell = finished[b].glyphs[i];
+                visit(cell.x, cell.y, cell.glyph, cell.color);
+            }
+    }
+
+    // Picks the coarsest LOD whose error projects to less than
+    // lod_error_cells at the nearest point of the mesh's bounding sphere.
+    size_t select_lod(const Mesh &mesh, const Mat4 &mv_matrix, const Mat4 &projection_matrix) const
+    {
+        if (!use_lods)
+            return 0;
+        Vec4 center = mv_matrix.transform({mesh.center.x, mesh.center.y, mesh.center.z, 1.0f});
+        float nearest = -center.z - mesh.radius;
+        if (nearest <= 0.0f)
+            return 0;
+        float cells_per_unit = std::max(projection_matrix.m[0] * 0.5f * width,
+                                        projection_matrix.m[5] * 0.5f * height) / nearest;
+        size_t lod = 0;
+        while (lod + 1 < mesh.lods.size() && mesh.lods[lod + 1].error * cells_per_unit < lod_error_cells)
+            ++lod;
+        return lod;
+    }
+
+    // Draws a frame synchronously; afterwards char_buffer and stats hold it.
+    void draw(const Model &model, const FrameView &view, const Bvh *bvh = nullptr)
+    {
+        begin_draw(model, view, bvh);
+        finish_draw();
+    }
+
+    // Starts drawing a frame on the thread pool and returns without waiting
+    // for it. The model, and bvh if given, must stay alive until
+    // finish_draw(). With a single thread nothing runs until finish_draw().
+    // bvh, built over model, allows the frame to be ray cast.
+    void begin_draw(const Model &model, const FrameView &view, const Bvh *bvh = nullptr)
+    {
+        AllocationTracking tracking;
+        assert(!drawing && "finish_draw() must be called first");
+        char_buffer.swap(front_char_buffer);
+        color_buffer.swap(front_color_buffer);
+        std::swap(arena, front_arena);
+        std::swap(bins, front_bins);
+        std::swap(stats, front_stats);
+        front_width = width;
+        front_height = height;
+        front_bin_count = bins_x * bins_y;
+        if (pending_width != width || pending_height != height)
+            allocate_grid(pending_width, pending_height);
+        // The grid swapped back in may be from before a resize.
+        size_t cells = static_cast<size_t>(width) * height;
+        if (char_buffer.size() != cells)
+        {
+            char_buffer.assign(cells, ' ');
+            color_buffer.assign(cells, 0);
+        }
+
+        frame_start = std::chrono::steady_clock::now();
+        arena.reset();
+        stats = FrameStats();
+        stats.grid_cells = static_cast<size_t>(width) * height;
+        frame_model = &model;
+        frame_view = view;
+        Mat4 mv_matrix = Mat4::multiply(view.view_matrix, view.model_matrix);
+        frame_mvp = Mat4::multiply(view.projection_matrix, mv_matrix);
+        begin_temporal(model, view);
+        if (bvh && use_ray_cast(model, mv_matrix, view.projection_matrix, *bvh))
+        {
+            begin_ray_cast(*bvh);
+            return;
+        }
+        frame_bvh = nullptr;
+
+        // Every vertex is projected up front, in parallel, so setup jobs can
+        // share them without synchronisation. Compact meshes are transformed
+        // mesh by mesh with their dequantization folded into the matrix.
+        size_t vertex_count = model.compact() ? model.quantized.size() : model.positions.size();
+        projected = arena.alloc<ProjectedVertex>(vertex_count);
+        stats.vertices_transformed = vertex_count;
+        size_t transform_chunk_count = 0;
+        if (model.compact())
+            for (const Mesh &mesh : model.meshes)
+                transform_chunk_count += (mesh.vertex_count + TRANSFORM_CHUNK - 1) / TRANSFORM_CHUNK;
+        else
+            transform_chunk_count = (vertex_count + TRANSFORM_CHUNK - 1) / TRANSFORM_CHUNK;
+        transform_chunks = arena.alloc<TransformChunk>(transform_chunk_count);
+        if (model.compact())
+        {
+            size_t c = 0;
+            for (const Mesh &mesh : model.meshes)
+            {
+                Mat4 mvp = Mat4::multiply(frame_mvp, mesh.dequantize_matrix());
+                size_t end = mesh.vertex_base + mesh.vertex_count;
+                for (size_t v = mesh.vertex_base; v < end; v += TRANSFORM_CHUNK)
+                    transform_chunks[c++] = {v, std::min(end, v + TRANSFORM_CHUNK), mvp};
+            }
+        }
+        else
+            for (size_t c = 0; c < transform_chunk_count; ++c)
+                transform_chunks[c] = {c * TRANSFORM_CHUNK, std::min(vertex_count, (c + 1) * TRANSFORM_CHUNK),
+                                       frame_mvp};
+
+        // Split each mesh's selected LOD into fixed-size setup chunks. Each
+        // chunk writes its triangles from first_triangle onwards; the bin
+        // job closes the gaps left by culled triangles.
+        setup_chunk_count = 0;
+        for (const Mesh &mesh : model.meshes)
+        {
+            size_t faces = mesh.lods[select_lod(mesh, mv_matrix, view.projection_matrix)].index_count() / 3;
+            setup_chunk_count += (faces + SETUP_CHUNK - 1) / SETUP_CHUNK;
+        }
+        setup_chunks = arena.alloc<SetupChunk>(setup_chunk_count);
+        if (cache_faces)
+            prepare_face_cache(model, view);
+        size_t max_triangles = 0, c = 0;
+        for (size_t m = 0; m < model.meshes.size(); ++m)
+        {
+            const Mesh &mesh = model.meshes[m];
+            size_t lod_index = select_lod(mesh, mv_matrix, view.projection_matrix);
+            const MeshLod &lod = mesh.lods[lod_index];
+            stats.lod_triangles_skipped += (mesh.lods[0].index_count() - lod.index_count()) / 3;
+            size_t faces = lod.index_count() / 3;
+
+            // Jobs of this frame fill the LOD's entries, and no later frame
+            // starts before they finish, so they can be marked ready now.
+            FacePlane *planes = nullptr;
+            FaceShading *shading = nullptr;
+            bool fill_planes = false, fill_shading = false;
+            if (cache_faces)
+            {
+                size_t slot = face_cache.first_lod[m] + lod_index;
+                planes = face_cache.planes.data() + face_cache.first_face[slot];
+                shading = face_cache.shading.data() + face_cache.first_face[slot];
+                fill_planes = !face_cache.planes_ready[slot];
+                fill_shading = !face_cache.shading_ready[slot];
+                face_cache.planes_ready[slot] = face_cache.shading_ready[slot] = 1;
+                ++(fill_planes ? stats.plane_cache_misses : stats.plane_cache_hits);
+                ++(fill_shading ? stats.shading_cache_misses : stats.shading_cache_hits);
+            }
+            for (size_t f = 0; f < faces; f += SETUP_CHUNK, ++c)
+            {
+                SetupChunk &chunk = setup_chunks[c];
+                chunk.mesh = &mesh;
+                chunk.lod = &lod;
+                chunk.planes = planes;
+                chunk.shading = shading;
+                chunk.fill_planes = fill_planes;
+                chunk.fill_shading = fill_shading;
+                chunk.begin = f;
+                chunk.end = std::min(faces, f + SETUP_CHUNK);
+                chunk.first_triangle = max_triangles + f;
+                chunk.count = 0;
+                chunk.stats = FrameStats();
+            }
+            max_triangles += faces;
+        }
+        triangles = arena.alloc<ScreenTriangle>(max_triangles);
+        triangle_textures = model.textured() ? arena.alloc<TriangleTexture>(max_triangles) : nullptr;
+        triangle_count = 0;
+
+        int bin_count = bins_x * bins_y;
+        bins = arena.alloc<Bin>(bin_count);
+        for (int b = 0; b < bin_count; ++b)
+        {
+            bins[b].stats = FrameStats();
+            bins[b].glyph_count = 0;
+        }
+
+        graph.clear();
+        uint32_t classified = 0;
+        if (frame_reuses_history)
+        {
+            // Reprojection only reads the last frame, so it overlaps the
+            // transform and setup stages.
+            classified = graph.add("classify", &classify_job, this);
+            for (int b = 0; b < bin_count; ++b)
+                graph.depend(graph.add("reproject", &reproject_job, this, b), classified);
+        }
+        uint32_t transformed = graph.add(nullptr, nullptr, nullptr);
+        for (size_t k = 0; k < transform_chunk_count; ++k)
+            graph.depend(graph.add("transform", &transform_job, this, k), transformed);
+        uint32_t first_setup = static_cast<uint32_t>(graph.size());
+        for (size_t k = 0; k < setup_chunk_count; ++k)
+            graph.depend(transformed, graph.add("setup", &setup_job, this, k));
+        uint32_t binned = graph.add("bin", &bin_job, this);
+        for (uint32_t setup = first_setup; setup < binned; ++setup)
+            graph.depend(setup, binned);
+        if (frame_reuses_history)
+            graph.depend(classified, binned);
+        for (int b = 0; b < bin_count; ++b)
+        {
+            uint32_t raster = graph.add("raster", &raster_job, this, b);
+            graph.depend(binned, raster);
+            graph.depend(raster, graph.add("resolve", &resolve_job, this, b));
+        }
+        pool->start(graph);
+        drawing = true;
+    }
+
+    // Resizes the face cache for a new model and forgets shading when the
+    // light or ramp changed. Planes depend on the model alone.
+    void prepare_face_cache(const Model &model, const FrameView &view)
+    {
+        FaceCache &cache = face_cache;
+        if (cache.model_id != model.id)
+        {
+            cache.model_id = model.id;
+            cache.first_lod.clear();
+            cache.first_face.clear();
+            size_t faces = 0;
+            for (const Mesh &mesh : model.meshes)
+            {
+                cache.first_lod.push_back(cache.first_face.size());
+                for (const MeshLod &lod : mesh.lods)
+                {
+                    cache.first_face.push_back(faces);
+                    faces += lod.index_count() / 3;
+                }
+            }
+            cache.planes.resize(faces);
+            cache.shading.resize(faces);
+            cache.planes_ready.assign(cache.first_face.size(), 0);
+            cache.shading_ready.assign(cache.first_face.size(), 0);
+        }
+        const Vec3 &light = view.light_direction;
+        if (light.x != cache.light_direction.x || light.y != cache.light_direction.y ||
+            light.z != cache.light_direction.z || cache.ramp != ramp)
+        {
+            cache.light_direction = light;
+            cache.ramp = ramp;
+            std::fill(cache.shading_ready.begin(), cache.shading_ready.end(), 0);
+        }
+    }
+
+    // Whether this frame is ray cast: always or never as render_path says,
+    // or for RenderPath::Auto, when the LODs it would rasterize have more
+    // than ray_cast_ratio triangles per cell.
+    bool use_ray_cast(const Model &model, const Mat4 &mv_matrix, const Mat4 &projection_matrix, const Bvh &bvh) const
+    {
+        if (bvh.empty() || render_path == RenderPath::Raster)
+            return false;
+        if (render_path == RenderPath::RayCast)
+            return true;
+        size_t faces = 0;
+        for (const Mesh &mesh : model.meshes)
+            faces += mesh.lods[select_lod(mesh, mv_matrix, projection_matrix)].index_count() / 3;
+        return faces > ray_cast_ratio * width * height;
+    }
+
+    // Starts a frame that casts a ray per cell instead of rasterizing. Its
+    // cells are sampled at their centres like a rasterized frame's, so it
+    // leaves usable history for temporal reuse, but reuses none itself.
+    void begin_ray_cast(const Bvh &bvh)
+    {
+        frame_bvh = &bvh;
+        frame_inverse_mvp = Mat4::inverse(frame_mvp);
+        frame_reuses_history = false;
+        setup_chunk_count = 0;
+        triangle_count = 0;
+
+        int bin_count = bins_x * bins_y;
+        bins = arena.alloc<Bin>(bin_count);
+        for (int b = 0; b < bin_count; ++b)
+        {
+            bins[b].stats = FrameStats();
+            bins[b].large_count = 0;
+            bins[b].small.count = 0;
+            bins[b].glyphs = arena.alloc<GlyphCell>(BIN_WIDTH * BIN_HEIGHT);
+            bins[b].glyph_count = 0;
+        }
+        graph.clear();
+        for (int b = 0; b < bin_count; ++b)
+            graph.depend(graph.add("trace", &trace_job, this, b), graph.add("resolve", &resolve_job, this, b));
+        pool->start(graph);
+        drawing = true;
+    }
+
+    // Decides whether this frame may reuse the last one. History is dropped
+    // when the grid, model, light or ramp changes, and on refresh frames.
+    void begin_temporal(const Model &model, const FrameView &view)
+    {
+        history_moved = frame_reuses_history;
+        frame_reuses_history = false;
+        if (temporal_refresh <= 0)
+        {
+            history_valid = false;
+            return;
+        }
+        size_t cells = static_cast<size_t>(width) * height;
+        reprojected.resize(cells);
+        cell_stable.resize(cells);
+        cell_reused.resize(cells);
+        tile_reused.resize(tiles_x * tiles_y);
+
+        const Vec3 &light = view.light_direction;
+        bool same_scene = history_model == model.id && history_ramp == ramp && light.x == history_light.x &&
+                          light.y == history_light.y && light.z == history_light.z;
+        frame_reuses_history = history_valid && same_scene && ++frames_since_refresh < temporal_refresh;
+        if (!frame_reuses_history)
+            frames_since_refresh = 0;
+        else
+            frame_reprojection = Mat4::multiply(frame_mvp, Mat4::inverse(history_mvp));
+
+        // The last frame's clip z is rebuilt from its w; for a perspective
+        // projection both are affine in view-space z.
+        const float *p = view.projection_matrix.m;
+        history_z_scale = p[10] / p[11];
+        history_z_offset = p[14] - p[10] * p[15] / p[11];
+        history_model = model.id;
+        history_light = light;
+        history_ramp = ramp;
+        history_mvp = frame_mvp;
+        history_valid = true; // Left in the depth buffer by this frame's raster jobs
+    }
+
+    // Helps finish the frame started by begin_draw() and gathers its stats.
+    void finish_draw()
+    {
+        AllocationTracking tracking;
+        pool->wait();
+        drawing = false;
+
+        for (size_t k = 0; k < setup_chunk_count; ++k)
+            stats.merge(setup_chunks[k].stats);
+        for (int b = 0; b < bins_x * bins_y; ++b)
+            stats.merge(bins[b].stats);
+        stats.add_timings(graph);
+        stats.frame_ms =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+    }
+
+    static void transform_job(void *context, size_t chunk)
+    {
+        AsciiRenderer *self = static_cast<AsciiRenderer *>(context);
+        self->transform_vertices(self->transform_chunks[chunk]);
+    }
+    static void setup_job(void *context, size_t chunk)
+    {
+        AsciiRenderer *self = static_cast<AsciiRenderer *>(context);
+        self->setup_triangles(self->setup_chunks[chunk]);
+    }
+    static void trace_job(void *context, size_t bin) { static_cast<AsciiRenderer *>(context)->trace_bin(bin); }
+    static void reproject_job(void *context, size_t bin) { static_cast<AsciiRenderer *>(context)->reproject_bin(bin); }
+    static void classify_job(void *context, size_t) { static_cast<AsciiRenderer *>(context)->classify_cells(); }
+    static void bin_job(void *context, size_t) { static_cast<AsciiRenderer *>(context)->bin_triangles(); }
+    static void raster_job(void *context, size_t bin) { static_cast<AsciiRenderer *>(context)->rasterize_bin(bin); }
+    static void resolve_job(void *context, size_t bin) { static_cast<AsciiRenderer *>(context)->resolve_bin(bin); }
+
+    void transform_vertices(const TransformChunk &chunk)
+    {
+        if (frame_model->compact())
+        {
+            const QuantizedVertex *quantized = frame_model->quantized.data();
+            for (size_t v = chunk.begin; v < chunk.end; ++v)
+                project_vertex(chunk.mvp, {static_cast<float>(quantized[v].x), static_cast<float>(quantized[v].y),
+                                           static_cast<float>(quantized[v].z), 1.0f}, projected[v]);
+        }
+        else
+        {
+            const Vec3 *positions = frame_model->positions.data();
+            for (size_t v = chunk.begin; v < chunk.end; ++v)
+                project_vertex(chunk.mvp, {positions[v].x, positions[v].y, positions[v].z, 1.0f}, projected[v]);
+        }
+    }
+
+    void project_vertex(const Mat4 &mvp, const Vec4 &p, ProjectedVertex &pv) const
+    {
+        Vec4 v_clip = mvp.transform(p);
+        pv.visible = false;
+        if (v_clip.w <= 0) // Vertex is behind or on the camera plane
+            return;
+        pv.inv_w = 1.0f / v_clip.w;
+        float sx = (v_clip.x * pv.inv_w + 1.0f) * 0.5f * width;
+        float sy = (1.0f - v_clip.y * pv.inv_w) * 0.5f * height;
+        if (std::abs(sx) > GUARD_BAND_CELLS || std::abs(sy) > GUARD_BAND_CELLS)
+            return; // Too close to the camera plane to snap
+        pv.x = static_cast<int32_t>(std::lround(sx * SUBPIXEL_ONE));
+        pv.y = static_cast<int32_t>(std::lround(sy * SUBPIXEL_ONE));
+        pv.visible = true;
+    }
+
+    // Flat lighting of a face with the given (unnormalized) normal; the
+    // material's ambient term brightens the glyph by ambient, its strongest
+    // channel.
+    static FaceShading shade_face(const Vec3 &normal, const Vec3 &light_direction, const Material &material,
+                                  float ambient, const std::string &glyphs)
+    {
+        FaceShading shading;
+        float lambert = Vec3::dot(Vec3::normalize(normal), Vec3::scale(light_direction, -1.0f));
+        shading.intensity = std::max(0.1f, lambert); // Ambient light
+        shading.glyph = get_ascii_char(std::min(1.0f, shading.intensity + ambient), glyphs);
+        shading.color = pack_rgb565(Vec3::add(material.ambient, Vec3::scale(material.diffuse, shading.intensity)));
+        return shading;
+    }
+
+    // Picks the chunk's index width and vertex format, then runs setup.
+    void setup_triangles(SetupChunk &chunk)
+    {
+        if (!frame_model->compact())
+        {
+            const Vec3 *positions = frame_model->positions.data();
+            setup_triangles(chunk, chunk.lod->indices.data(), 0, [positions](uint32_t v) { return positions[v]; });
+            return;
+        }
+        const Mesh &mesh = *chunk.mesh;
+        const QuantizedVertex *quantized = frame_model->quantized.data() + mesh.vertex_base;
+        Vec3 origin = mesh.bounds_min, step = mesh.quantization_step;
+        auto position = [origin, step, quantized](uint32_t v) {
+            const QuantizedVertex &q = quantized[v];
+            return Vec3{origin.x + q.x * step.x, origin.y + q.y * step.y, origin.z + q.z * step.z};
+        };
+        if (!chunk.lod->indices16.empty())
+            setup_triangles(chunk, chunk.lod->indices16.data(), mesh.vertex_base, position);
+        else
+            setup_triangles(chunk, chunk.lod->indices.data(), mesh.vertex_base, position);
+    }
+
+    // indices[i] + vertex_base is the vertex's slot in projected;
+    // position(indices[i]) is its model-space position.
+    template <typename Index, typename Position>
+    void setup_triangles(SetupChunk &chunk, const Index *indices, uint32_t vertex_base, Position position)
+    {
+        const Vec3 &camera_pos = frame_view.camera_pos;
+        const Vec3 &light_direction = frame_view.light_direction;
+        ScreenTriangle *out = triangles + chunk.first_triangle;
+        const Material &material = frame_model->materials[chunk.mesh->material];
+        const std::string &glyphs = material.ramp.empty() ? ramp : material.ramp;
+        float ambient = std::max({material.ambient.x, material.ambient.y, material.ambient.z});
+        const LuminanceTexture *texture =
+            triangle_textures && material.texture >= 0 ? &frame_model->textures[material.texture] : nullptr;
+        const TexCoord *texcoords = texture ? frame_model->texcoords.data() + vertex_base : nullptr;
+        TriangleTexture *out_textures = triangle_textures ? triangle_textures + chunk.first_triangle : nullptr;
+
+        for (size_t f = chunk.begin * 3; f < chunk.end * 3; f += 3)
+        {
+            ++chunk.stats.triangles_submitted;
+
+            // Back-face culling; only the sign matters, so nothing is
+            // normalized until a triangle survives. With a cached plane the
+            // vertices aren't touched at all.
+            FacePlane plane;
+            if (chunk.planes && !chunk.fill_planes)
+                plane = chunk.planes[f / 3];
+            else
+            {
+                const Vec3 v_world[3] = {position(indices[f]), position(indices[f + 1]), position(indices[f + 2])};
+                Vec3 edge1 = Vec3::subtract(v_world[1], v_world[0]);
+                Vec3 edge2 = Vec3::subtract(v_world[2], v_world[0]);
+                plane.normal = Vec3::cross(edge1, edge2);
+                plane.d = Vec3::dot(plane.normal, v_world[0]);
+                if (chunk.planes)
+                    chunk.planes[f / 3] = plane;
+            }
+            // A frame filling the shading cache shades back faces too, since
+            // they may face the camera in later frames.
+            bool back_facing = plane.d >= Vec3::dot(plane.normal, camera_pos);
+            if (back_facing && !(chunk.shading && chunk.fill_shading))
+            {
+                ++chunk.stats.triangles_culled;
+                continue;
+            }
+
+            FaceShading shading;
+            if (chunk.shading && !chunk.fill_shading)
+                shading = chunk.shading[f / 3];
+            else
+            {
+                shading = shade_face(plane.normal, light_direction, material, ambient, glyphs);
+                if (chunk.shading)
+                    chunk.shading[f / 3] = shading;
+            }
+            if (back_facing)
+            {
+                ++chunk.stats.triangles_culled;
+                continue;
+            }
+            float intensity = shading.intensity;
+
+            ScreenTriangle &tri = out[chunk.count];
+            tri.glyph = shading.glyph;
+            tri.color = shading.color;
+
+            bool behind_camera = false;
+            for (int i = 0; i < 3; ++i)
+            {
+                const ProjectedVertex &pv = projected[vertex_base + indices[f + i]];
+                behind_camera |= !pv.visible;
+                tri.x[i] = pv.x;
+                tri.y[i] = pv.y;
+                tri.inv_w[i] = pv.inv_w;
+            }
+            if (behind_camera || !orient(tri))
+            {
+                ++chunk.stats.triangles_culled;
+                continue;
+            }
+            // Triangles that miss every cell centre are dropped here rather
+            // than in the serial bin job.
+            CellBounds cb = cell_bounds(tri);
+            if (cb.min_x > cb.max_x || cb.min_y > cb.max_y)
+            {
+                ++chunk.stats.triangles_empty;
+                continue;
+            }
+            if (out_textures)
+            {
+                TriangleTexture &tex = out_textures[chunk.count];
+                tex.level = nullptr;
+                if (texture)
+                {
+                    // orient() swaps vertices 1 and 2 to fix the winding;
+                    // they can't coincide, so a moved vertex 1 shows it did.
+                    const ProjectedVertex &pv1 = projected[vertex_base + indices[f + 1]];
+                    bool swapped = tri.x[1] != pv1.x || tri.y[1] != pv1.y;
+                    TexCoord uv[3] = {texcoords[indices[f]], texcoords[indices[f + (swapped ? 2 : 1)]],
+                                      texcoords[indices[f + (swapped ? 1 : 2)]]};
+                    set_texture(tex, tri, uv, *texture);
+                    tex.intensity = std::min(1.0f, intensity + ambient);
+                    tex.ramp = &glyphs;
+                    ++chunk.stats.triangles_textured;
+                }
+            }
+            ++chunk.count;
+        }
+    }
+
+    // Picks the mip level for a triangle's footprint, the ratio of its
+    // texel area to its cell area, and maps its texture coordinates into
+    // that level. v runs up the image, rows down.
+    static void set_texture(TriangleTexture &tex, const ScreenTriangle &tri, const TexCoord uv[3],
+                            const LuminanceTexture &texture)
+    {
+        const LuminanceTexture::Level &base = texture.levels[0];
+        float uv_area = (uv[1].u - uv[0].u) * (uv[2].v - uv[0].v) - (uv[2].u - uv[0].u) * (uv[1].v - uv[0].v);
+        float texel_area = std::fabs(uv_area) * base.width * base.height;
+        float cell_area = static_cast<float>(edge(tri.x[0], tri.y[0], tri.x[1], tri.y[1], tri.x[2], tri.y[2])) /
+                          (static_cast<float>(SUBPIXEL_ONE) * SUBPIXEL_ONE);
+        tex.level = &texture.level_for(texel_area / cell_area);
+        for (int i = 0; i < 3; ++i)
+        {
+            tex.u[i] = uv[i].u * tex.level->width * tri.inv_w[i];
+            tex.v[i] = (1.0f - uv[i].v) * tex.level->height * tri.inv_w[i];
+        }
+    }
+
+    int bin_of(int x, int y) const { return (y / BIN_HEIGHT) * bins_x + x / BIN_WIDTH; }
+
+    // Compacts the setup output, sorts it, and hands every triangle to the
+    // bins it overlaps (setup has already dropped empty ones): single-cell triangles to their cell's bin batch,
+    // larger ones to an index list in every bin their bounds touch. Bins
+    // keep the sorted order, so each bin rasterizes exactly the sequence the
+    // whole grid would have.
+    void bin_triangles()
+    {
+        for (size_t k = 0; k < setup_chunk_count; ++k)
+        {
+            const SetupChunk &chunk = setup_chunks[k];
+            if (triangle_count != chunk.first_triangle)
+            {
+                std::memmove(triangles + triangle_count, triangles + chunk.first_triangle,
+                             chunk.count * sizeof(ScreenTriangle));
+                if (triangle_textures)
+                    std::memmove(triangle_textures + triangle_count, triangle_textures + chunk.first_triangle,
+                                 chunk.count * sizeof(TriangleTexture));
+            }
+            triangle_count += chunk.count;
+        }
+
+        const uint32_t *order = sort_front_to_back ? sort_by_depth(triangles, triangle_count) : nullptr;
+        CellBounds *bounds = arena.alloc<CellBounds>(triangle_count);
+        int bin_count = bins_x * bins_y;
+        for (int b = 0; b < bin_count; ++b)
+        {
+            bins[b].large_count = 0;
+            bins[b].small.count = 0;
+        }
+
+        // Count per bin, then carve exact-sized lists and fill them.
+        for (size_t t = 0; t < triangle_count; ++t)
+        {
+            const CellBounds &cb = bounds[t] = cell_bounds(triangles[t]);
+            if (single_cell(triangles[t], cb))
+                ++stats.triangles_single_cell;
+            else
+                ++stats.triangles_large;
+            if (batched(static_cast<uint32_t>(t), cb))
+            {
+                if (!reused_cell(cb.min_y * width + cb.min_x))
+                    ++bins[bin_of(cb.min_x, cb.min_y)].small.count;
+            }
+            else
+            {
+                for (int by = cb.min_y / BIN_HEIGHT; by <= cb.max_y / BIN_HEIGHT; ++by)
+                    for (int bx = cb.min_x / BIN_WIDTH; bx <= cb.max_x / BIN_WIDTH; ++bx)
+                        ++bins[by * bins_x + bx].large_count;
+            }
+        }
+        for (int b = 0; b < bin_count; ++b)
+        {
+            Bin &bin = bins[b];
+            bin.large = arena.alloc<uint32_t>(bin.large_count);
+            bin.bounds = bounds;
+            bin.small = SmallTriangleBatch::create(arena, bin.small.count);
+            bin.glyphs = arena.alloc<GlyphCell>(BIN_WIDTH * BIN_HEIGHT);
+            bin.large_count = 0;
+        }
+        for (size_t i = 0; i < triangle_count; ++i)
+        {
+            uint32_t t = order ? order[i] : static_cast<uint32_t>(i);
+            const CellBounds &cb = bounds[t];
+            if (batched(t, cb))
+            {
+                if (reused_cell(cb.min_y * width + cb.min_x))
+                    continue;
+                bins[bin_of(cb.min_x, cb.min_y)].small.add(triangles[t], cb.min_y * width + cb.min_x, cb.min_x,
+                                                           cb.min_y);
+                continue;
+            }
+            for (int by = cb.min_y / BIN_HEIGHT; by <= cb.max_y / BIN_HEIGHT; ++by)
+                for (int bx = cb.min_x / BIN_WIDTH; bx <= cb.max_x / BIN_WIDTH; ++bx)
+                {
+                    Bin &bin = bins[by * bins_x + bx];
+                    bin.large[bin.large_count++] = t;
+                }
+        }
+    }
+
+    // Clears the bin's cells and tiles, then draws its triangles.
+    void rasterize_bin(size_t b)
+    {
+        Bin &bin = bins[b];
+        int x0 = static_cast<int>(b % bins_x) * BIN_WIDTH, y0 = static_cast<int>(b / bins_x) * BIN_HEIGHT;
+        int x1 = std::min(width, x0 + BIN_WIDTH), y1 = std::min(height, y0 + BIN_HEIGHT);
+        for (int y = y0; y < y1; ++y)
+        {
+            std::fill(depth_buffer.begin() + y * width + x0, depth_buffer.begin() + y * width + x1, 0.0f); // 1/w
+            std::fill(char_buffer.begin() + y * width + x0, char_buffer.begin() + y * width + x1, ' ');
+        }
+        for (int ty = y0 / HIZ_TILE; ty * HIZ_TILE < y1; ++ty)
+            for (int tx = x0 / HIZ_TILE; tx * HIZ_TILE < x1; ++tx)
+            {
+                tile_far[ty * tiles_x + tx] = 0.0f;
+                tile_near[ty * tiles_x + tx] = 0.0f;
+                tile_dirty[ty * tiles_x + tx] = 0;
+            }
+        size_t reused = frame_reuses_history ? restore_reused_cells(x0, y0, x1, y1) : 0;
+        bin.stats.cells_reused = reused;
+
+        for (size_t i = 0; i < bin.large_count; ++i)
+        {
+            CellBounds cb = bin.bounds[bin.large[i]];
+            cb.min_x = std::max(cb.min_x, x0);
+            cb.max_x = std::min(cb.max_x, x1 - 1);
+            cb.min_y = std::max(cb.min_y, y0);
+            cb.max_y = std::min(cb.max_y, y1 - 1);
+            rasterize(triangles[bin.large[i]], triangle_textures ? &triangle_textures[bin.large[i]] : nullptr, cb,
+                      bin.stats);
+        }
+        rasterize_small(bin.small, bin.stats);
+        if (reused)
+            settle_reused_cells(x0, y0, x1, y1);
+    }
+
+    // Casts a ray through the centre of each of the bin's cells. A bin is
+    // the packet of rays one worker traces: neighbouring rays walk the same
+    // upper nodes, which stay in that core's cache.
+    void trace_bin(size_t b)
+    {
+        Bin &bin = bins[b];
+        int x0 = static_cast<int>(b % bins_x) * BIN_WIDTH, y0 = static_cast<int>(b / bins_x) * BIN_HEIGHT;
+        int x1 = std::min(width, x0 + BIN_WIDTH), y1 = std::min(height, y0 + BIN_HEIGHT);
+        const float *m = frame_mvp.m;
+        for (int y = y0; y < y1; ++y)
+            for (int x = x0; x < x1; ++x)
+            {
+                int cell = y * width + x;
+                Ray ray = cell_ray(frame_inverse_mvp, x + 0.5f, y + 0.5f, width, height);
+                RayHit hit;
+                ++bin.stats.rays_cast;
+                if (!frame_bvh->intersect(ray, &hit, 1.0f))
+                {
+                    depth_buffer[cell] = 0.0f;
+                    char_buffer[cell] = ' ';
+                    continue;
+                }
+                ++bin.stats.ray_hits;
+                Vec3 p = Vec3::add(ray.origin, Vec3::scale(ray.direction, hit.t));
+                depth_buffer[cell] = 1.0f / (m[3] * p.x + m[7] * p.y + m[11] * p.z + m[15]);
+                shade_hit(hit, cell);
+            }
+    }
+
+    // Shades a ray hit as the rasterizer would its face, sampling the
+    // material's texture at the hit when it has one.
+    void shade_hit(const RayHit &hit, int cell)
+    {
+        const Model &model = *frame_model;
+        uint32_t mesh_index, face;
+        frame_bvh->locate(hit.face, &mesh_index, &face);
+        const Mesh &mesh = model.meshes[mesh_index];
+        const Material &material = model.materials[mesh.material];
+        const std::string &glyphs = material.ramp.empty() ? ramp : material.ramp;
+        float ambient = std::max({material.ambient.x, material.ambient.y, material.ambient.z});
+        Vec3 corners[3];
+        for (int k = 0; k < 3; ++k)
+            corners[k] = lod0_position(model, mesh, face * 3 + k);
+        Vec3 normal = Vec3::cross(Vec3::subtract(corners[1], corners[0]), Vec3::subtract(corners[2], corners[0]));
+        FaceShading shading = shade_face(normal, frame_view.light_direction, material, ambient, glyphs);
+        char_buffer[cell] = shading.glyph;
+        color_buffer[cell] = shading.color;
+        if (material.texture < 0 || !model.textured())
+            return;
+
+        // The mip level follows the face's texel area over its cell area,
+        // as in set_texture().
+        const LuminanceTexture &texture = model.textures[material.texture];
+        TexCoord uv[3];
+        float sx[3], sy[3];
+        bool projected_ok = true;
+        for (int k = 0; k < 3; ++k)
+        {
+            uv[k] = model.texcoords[lod0_vertex(model, mesh, face * 3 + k)];
+            Vec4 clip = frame_mvp.transform({corners[k].x, corners[k].y, corners[k].z, 1.0f});
+            projected_ok &= clip.w > 0.0f;
+            sx[k] = clip.x / clip.w * 0.5f * width;
+            sy[k] = clip.y / clip.w * 0.5f * height;
+        }
+        const LuminanceTexture::Level *level = &texture.levels[0];
+        float cell_area = std::fabs((sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]));
+        if (projected_ok && cell_area > 0.0f)
+        {
+            float uv_area = (uv[1].u - uv[0].u) * (uv[2].v - uv[0].v) - (uv[2].u - uv[0].u) * (uv[1].v - uv[0].v);
+            level = &texture.level_for(std::fabs(uv_area) * level->width * level->height / cell_area);
+        }
+        float w0 = 1.0f - hit.u - hit.v;
+        float u = w0 * uv[0].u + hit.u * uv[1].u + hit.v * uv[2].u;
+        float v = w0 * uv[0].v + hit.u * uv[1].v + hit.v * uv[2].v;
+        uint8_t luminance = level->at(static_cast<int>(std::floor(u * level->width)),
+                                      static_cast<int>(std::floor((1.0f - v) * level->height)));
+        char_buffer[cell] = get_ascii_char(std::min(1.0f, shading.intensity + ambient) * luminance * (1.0f / 255.0f),
+                                           glyphs);
+    }
+
+    // Whether this frame copies the cell from the last.
+    bool reused_cell(int cell) const { return frame_reuses_history && cell_reused[cell]; }
+
+    // Moves the bin's last samples into this frame and marks the cells that
+    // are stable: covered, with a sample that stays within
+    // MAX_SAMPLE_DRIFT of the cell's centre and a depth that steps by no
+    // more than MAX_DEPTH_STEP to any neighbour. A larger step or an empty
+    // neighbour marks an edge, where cells get occluded or disoccluded as
+    // the model turns. Glyph and depth stand in for a triangle-ID buffer:
+    // shading is flat per face, so the glyph is what an ID would look up.
+    void reproject_bin(size_t b)
+    {
+        int x0 = static_cast<int>(b % bins_x) * BIN_WIDTH, y0 = static_cast<int>(b / bins_x) * BIN_HEIGHT;
+        int x1 = std::min(width, x0 + BIN_WIDTH), y1 = std::min(height, y0 + BIN_HEIGHT);
+        for (int y = y0; y < y1; ++y)
+            for (int x = x0; x < x1; ++x)
+                cell_stable[y * width + x] = depth_buffer[y * width + x] != 0.0f && reproject_cell(x, y);
+    }
+
+    // Whether a covered cell is stable; leaves its moved sample in
+    // reprojected.
+    bool reproject_cell(int x, int y)
+    {
+        int cell = y * width + x;
+        float inv_w = depth_buffer[cell];
+        const int dx[4] = {-1, 1, 0, 0}, dy[4] = {0, 0, -1, 1};
+        for (int i = 0; i < 4; ++i)
+        {
+            int nx = x + dx[i], ny = y + dy[i];
+            if (nx < 0 || ny < 0 || nx >= width || ny >= height)
+                continue;
+            if (std::abs(depth_buffer[ny * width + nx] - inv_w) > MAX_DEPTH_STEP * inv_w)
+                return false;
+        }
+
+        // A cell drawn last frame was sampled at its centre; a reused one
+        // shows the sample it carried forward.
+        CellSample &moved = reprojected[cell];
+        bool carried = history_moved && cell_reused[cell];
+        float sx = carried ? moved.x : x + 0.5f, sy = carried ? moved.y : y + 0.5f;
+        float w = 1.0f / inv_w;
+        Vec4 clip = frame_reprojection.transform({(2.0f * sx / width - 1.0f) * w, (1.0f - 2.0f * sy / height) * w,
+                                                  w * history_z_scale + history_z_offset, w});
+        if (clip.w <= 0.0f)
+            return false;
+        moved.inv_w = 1.0f / clip.w;
+        moved.x = (clip.x * moved.inv_w + 1.0f) * 0.5f * width;
+        moved.y = (1.0f - clip.y * moved.inv_w) * 0.5f * height;
+        float drift_x = moved.x - (x + 0.5f), drift_y = moved.y - (y + 0.5f);
+        return drift_x * drift_x + drift_y * drift_y <= MAX_SAMPLE_DRIFT * MAX_SAMPLE_DRIFT;
+    }
+
+    // Reuses stable cells whose eight neighbours are stable too, so an edge
+    // is always at least two cells from a reused cell, and notes the HiZ
+    // tiles that are reused whole.
+    void classify_cells()
+    {
+        // Erode the stable cells by one: along rows into cell_reused, then
+        // along columns back into cell_stable, which is no longer needed.
+        const unsigned char *stable = cell_stable.data();
+        unsigned char *rows = cell_reused.data();
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x)
+            {
+                int cell = y * width + x;
+                rows[cell] = stable[cell] & stable[x > 0 ? cell - 1 : cell] & stable[x + 1 < width ? cell + 1 : cell];
+            }
+        for (int y = 0; y < height; ++y)
+        {
+            const unsigned char *above = rows + std::max(0, y - 1) * width, *row = rows + y * width;
+            const unsigned char *below = rows + std::min(height - 1, y + 1) * width;
+            for (int x = 0; x < width; ++x)
+                cell_stable[y * width + x] = above[x] & row[x] & below[x];
+        }
+        cell_reused.swap(cell_stable);
+        for (int tile = 0; tile < tiles_x * tiles_y; ++tile)
+        {
+            int x0 = (tile % tiles_x) * HIZ_TILE, y0 = (tile / tiles_x) * HIZ_TILE;
+            int x1 = std::min(width, x0 + HIZ_TILE), y1 = std::min(height, y0 + HIZ_TILE);
+            bool reuse = true;
+            for (int y = y0; reuse && y < y1; ++y)
+                for (int x = x0; x < x1; ++x)
+                    reuse = reuse && cell_reused[y * width + x];
+            tile_reused[tile] = reuse;
+            stats.tiles_reused += reuse;
+        }
+    }
+
+    // Copies the last frame's glyphs into the bin's reused cells and makes
+    // their depth reject every triangle, including through HiZ. Returns the
+    // number of cells reused.
+    size_t restore_reused_cells(int x0, int y0, int x1, int y1)
+    {
+        size_t reused = 0;
+        const float closest = std::numeric_limits<float>::max();
+        for (int y = y0; y < y1; ++y)
+            for (int x = x0; x < x1; ++x)
+            {
+                int cell = y * width + x;
+                if (!cell_reused[cell])
+                    continue;
+                depth_buffer[cell] = closest;
+                char_buffer[cell] = front_char_buffer[cell];
+                color_buffer[cell] = front_color_buffer[cell];
+                int tile = (y / HIZ_TILE) * tiles_x + x / HIZ_TILE;
+                tile_near[tile] = closest;
+                if (tile_reused[tile])
+                    tile_far[tile] = closest;
+                ++reused;
+            }
+        return reused;
+    }
+
+    // Leaves the reprojected depth in the bin's reused cells as the next
+    // frame's history.
+    void settle_reused_cells(int x0, int y0, int x1, int y1)
+    {
+        for (int y = y0; y < y1; ++y)
+            for (int x = x0; x < x1; ++x)
+                if (cell_reused[y * width + x])
+                    depth_buffer[y * width + x] = reprojected[y * width + x].inv_w;
+    }
+
+    // Gathers the bin's non-blank cells for presentation.
+    void resolve_bin(size_t b)
+    {
+        Bin &bin = bins[b];
+        int x0 = static_cast<int>(b % bins_x) * BIN_WIDTH, y0 = static_cast<int>(b / bins_x) * BIN_HEIGHT;
+        int x1 = std::min(width, x0 + BIN_WIDTH), y1 = std::min(height, y0 + BIN_HEIGHT);
+        for (int y = y0; y < y1; ++y)
+            for (int x = x0; x < x1; ++x)
+                if (char_buffer[y * width + x] != ' ')
+                    bin.glyphs[bin.glyph_count++] = {static_cast<uint16_t>(x), static_cast<uint16_t>(y),
+                                                     char_buffer[y * width + x], color_buffer[y * width + x]};
+        bin.stats.cells_covered = bin.glyph_count;
+    }
+
+    // Orders triangles nearest-first so hierarchical Z and the depth test
+    // reject as much as possible. Keys are each triangle's nearest 1/w
+    // quantized to 16 bits over the frame's range, sorted with a two-pass
+    // LSD radix sort; the result lives in the frame arena, so only the bin
+    // job may call it.
+    const uint32_t *sort_by_depth(const ScreenTriangle *triangles, size_t count)
+    {
+        uint16_t *keys = arena.alloc<uint16_t>(count);
+        uint32_t *order = arena.alloc<uint32_t>(count);
+        uint32_t *scratch = arena.alloc<uint32_t>(count);
+
+        float lo = std::numeric_limits<float>::max(), hi = 0.0f;
+        for (size_t t = 0; t < count; ++t)
+        {
+            const float *w = triangles[t].inv_w;
+            float nearest = std::max({w[0], w[1], w[2]});
+            lo = std::min(lo, nearest);
+            hi = std::max(hi, nearest);
+        }
+        float scale = hi > lo ? 65535.0f / (hi - lo) : 0.0f;
+        for (size_t t = 0; t < count; ++t)
+        {
+            const float *w = triangles[t].inv_w;
+            float nearest = std::max({w[0], w[1], w[2]});
+            keys[t] = static_cast<uint16_t>(65535 - static_cast<int>((nearest - lo) * scale));
+            order[t] = static_cast<uint32_t>(t);
+        }
+
+        for (int shift = 0; shift < 16; shift += 8)
+        {
+            size_t offsets[257] = {};
+            for (size_t t = 0; t < count; ++t)
+                ++offsets[((keys[order[t]] >> shift) & 0xFF) + 1];
+            for (int b = 0; b < 256; ++b)
+                offsets[b + 1] += offsets[b];
+            for (size_t t = 0; t < count; ++t)
+                scratch[offsets[(keys[order[t]] >> shift) & 0xFF]++] = order[t];
+            std::swap(order, scratch);
+        }
+        return order;
+    }
+
+    // Smallest 1/w in a tile, rescanning the cells if writes have made the
+    // cached value stale.
+    float refresh_tile_far(int tile)
+    {
+        if (tile_dirty[tile])
+        {
+            int x0 = (tile % tiles_x) * HIZ_TILE, y0 = (tile / tiles_x) * HIZ_TILE;
+            int x1 = std::min(width, x0 + HIZ_TILE), y1 = std::min(height, y0 + HIZ_TILE);
+            float far_value = depth_buffer[y0 * width + x0];
+            for (int y = y0; y < y1; ++y)
+                for (int x = x0; x < x1; ++x)
+                    far_value = std::min(far_value, depth_buffer[y * width + x]);
+            tile_far[tile] = far_value;
+            tile_dirty[tile] = 0;
+        }
+        return tile_far[tile];
+    }
+
+    // Edge function of a->b at p, positive on the inside of a triangle wound
+    // like ScreenTriangle.
+    static int64_t edge(int32_t ax, int32_t ay, int32_t bx, int32_t by, int64_t px, int64_t py)
+    {
+        return static_cast<int64_t>(bx - ax) * (py - ay) - static_cast<int64_t>(by - ay) * (px - ax);
+    }
+
+    // Bottom-right fill rule: a cell centre exactly on an edge belongs to the
+    // triangle only if, with y pointing down, the edge is a right edge
+    // (heading down) or a bottom edge (horizontal, heading left). The
+    // neighbour across a shared edge traverses it the other way, so exactly
+    // one of the two claims the cell.
+    static bool owns_edge(int32_t ax, int32_t ay, int32_t bx, int32_t by)
+    {
+        return by > ay || (by == ay && bx < ax);
+    }
+
+    // Fixes the winding so edge functions are positive inside; returns false
+    // for triangles with no area once snapped.
+    static bool orient(ScreenTriangle &tri)
+    {
+        int64_t area = edge(tri.x[0], tri.y[0], tri.x[1], tri.y[1], tri.x[2], tri.y[2]);
+        if (area == 0)
+            return false;
+        if (area < 0)
+        {
+            std::swap(tri.x[1], tri.x[2]);
+            std::swap(tri.y[1], tri.y[2]);
+            std::swap(tri.inv_w[1], tri.inv_w[2]);
+        }
+        return true;
+    }
+
+    // Range of cells whose centres lie inside a triangle's bounding box,
+    // clipped to the grid. Cell (x, y) is sampled at its centre,
+    // x * SUBPIXEL_ONE + SUBPIXEL_ONE / 2.
+    struct CellBounds
+    {
+        int min_x, max_x, min_y, max_y;
+    };
+
+    CellBounds cell_bounds(const ScreenTriangle &tri) const
+    {
+        const int32_t half = SUBPIXEL_ONE / 2;
+        auto first_cell = [](int32_t v) { return static_cast<int>((v - half + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS); };
+        auto last_cell = [](int32_t v) { return static_cast<int>((v - half) >> SUBPIXEL_BITS); };
+        return {std::max(0, first_cell(std::min({tri.x[0], tri.x[1], tri.x[2]}))),
+                std::min(width - 1, last_cell(std::max({tri.x[0], tri.x[1], tri.x[2]}))),
+                std::max(0, first_cell(std::min({tri.y[0], tri.y[1], tri.y[2]}))),
+                std::min(height - 1, last_cell(std::max({tri.y[0], tri.y[1], tri.y[2]})))};
+    }
+
+    // Whether a triangle's bounding box holds exactly one cell centre. The
+    // unclipped extent is checked too: a large triangle reaching off the
+    // grid can clip to a single cell, but its vertices may lie out to the
+    // guard band, far beyond what rasterize_small's 32-bit math allows.
+    static bool single_cell(const ScreenTriangle &tri, const CellBounds &cb)
+    {
+        const int32_t limit = 2 * SUBPIXEL_ONE;
+        return cb.min_x == cb.max_x && cb.min_y == cb.max_y &&
+               std::max({tri.x[0], tri.x[1], tri.x[2]}) - std::min({tri.x[0], tri.x[1], tri.x[2]}) < limit &&
+               std::max({tri.y[0], tri.y[1], tri.y[2]}) - std::min({tri.y[0], tri.y[1], tri.y[2]}) < limit;
+    }
+
+    // Single-cell triangles go to their bin's SIMD batch unless textured.
+    bool batched(uint32_t t, const CellBounds &cb) const
+    {
+        return single_cell(triangles[t], cb) && !(triangle_textures && triangle_textures[t].level);
+    }
+
+    // Triangles whose bounding box holds exactly one cell centre, stored as
+    // structure-of-arrays with vertices relative to that centre. single_cell()
+    // keeps each triangle's extent under two cells, so relative coordinates
+    // stay below 2 * SUBPIXEL_ONE, the edge functions and their sum fit in
+    // 32 bits, and rasterize_small's coverage loop vectorizes across
+    // triangles.
+    struct SmallTriangleBatch
+    {
+        int32_t *x[3], *y[3], *bias[3];
+        float *inv_w[3];
+        int32_t *cell;
+        char *glyph;
+        uint16_t *color;
+        float *depth;
+        unsigned char *covered;
+        size_t count;
+
+        static SmallTriangleBatch create(FrameArena &arena, size_t capacity)
+        {
+            SmallTriangleBatch batch;
+            for (int i = 0; i < 3; ++i)
+            {
+                batch.x[i] = arena.alloc<int32_t>(capacity);
+                batch.y[i] = arena.alloc<int32_t>(capacity);
+                batch.bias[i] = arena.alloc<int32_t>(capacity);
+                batch.inv_w[i] = arena.alloc<float>(capacity);
+            }
+            batch.cell = arena.alloc<int32_t>(capacity);
+            batch.glyph = arena.alloc<char>(capacity);
+            batch.color = arena.alloc<uint16_t>(capacity);
+            batch.depth = arena.alloc<float>(capacity);
+            batch.covered = arena.alloc<unsigned char>(capacity);
+            batch.count = 0;
+            return batch;
+        }
+
+        void add(const ScreenTriangle &tri, int cell_index, int cell_x, int cell_y)
+        {
+            int32_t px = cell_x * SUBPIXEL_ONE + SUBPIXEL_ONE / 2;
+            int32_t py = cell_y * SUBPIXEL_ONE + SUBPIXEL_ONE / 2;
+            const int i1[3] = {1, 2, 0}, i2[3] = {2, 0, 1};
+            for (int i = 0; i < 3; ++i)
+            {
+                x[i][count] = tri.x[i] - px;
+                y[i][count] = tri.y[i] - py;
+                inv_w[i][count] = tri.inv_w[i];
+                bias[i][count] = owns_edge(tri.x[i1[i]], tri.y[i1[i]], tri.x[i2[i]], tri.y[i2[i]]) ? 0 : -1;
+            }
+            cell[count] = cell_index;
+            glyph[count] = tri.glyph;
+            color[count] = tri.color;
+            ++count;
+        }
+    };
+
+    struct TransformChunk
+    {
+        size_t begin, end; // Vertex range
+        Mat4 mvp;          // Including the mesh's dequantization for compact models
+    };
+
+    struct SetupChunk
+    {
+        const Mesh *mesh;
+        const MeshLod *lod;
+        FacePlane *planes; // The LOD's face cache entries, or null when not caching
+        FaceShading *shading;
+        bool fill_planes, fill_shading; // Whether this frame computes them rather than reads them
+        size_t begin, end; // Face range within the LOD
+        size_t first_triangle;
+        size_t count; // Triangles that survived culling
+        FrameStats stats;
+    };
+
+    struct Bin
+    {
+        uint32_t *large; // Triangle indices, in draw order
+        size_t large_count;
+        const CellBounds *bounds; // Indexed by triangle
+        SmallTriangleBatch small;
+        GlyphCell *glyphs;
+        size_t glyph_count;
+        FrameStats stats;
+    };
+
+    // The glyph for a textured triangle at a cell with edge values e0..e2;
+    // scale turns their weighted sum into a perspective-correct coordinate.
+    static char sample(const TriangleTexture &tex, int64_t e0, int64_t e1, int64_t e2, float scale)
+    {
+        float w0 = static_cast<float>(e0), w1 = static_cast<float>(e1), w2 = static_cast<float>(e2);
+        float u = (w0 * tex.u[0] + w1 * tex.u[1] + w2 * tex.u[2]) * scale;
+        float v = (w0 * tex.v[0] + w1 * tex.v[1] + w2 * tex.v[2]) * scale;
+        uint8_t luminance = tex.level->at(static_cast<int>(std::floor(u)), static_cast<int>(std::floor(v)));
+        return get_ascii_char(tex.intensity * luminance * (1.0f / 255.0f), *tex.ramp);
+    }
+
+    void rasterize_small(SmallTriangleBatch &batch, FrameStats &bin_stats)
+    {
+        // Branch-free coverage and depth for every triangle; with the sample
+        // at the origin, edge i is x[i1] * y[i2] - y[i1] * x[i2].
+        for (size_t t = 0; t < batch.count; ++t)
+        {
+            int32_t w0 = batch.x[1][t] * batch.y[2][t] - batch.y[1][t] * batch.x[2][t];
+            int32_t w1 = batch.x[2][t] * batch.y[0][t] - batch.y[2][t] * batch.x[0][t];
+            int32_t w2 = batch.x[0][t] * batch.y[1][t] - batch.y[0][t] * batch.x[1][t];
+            batch.covered[t] = (w0 + batch.bias[0][t] >= 0) & (w1 + batch.bias[1][t] >= 0) & (w2 + batch.bias[2][t] >= 0);
+            float area = static_cast<float>(w0 + w1 + w2);
+            batch.depth[t] = (static_cast<float>(w0) * batch.inv_w[0][t] + static_cast<float>(w1) * batch.inv_w[1][t] +
+                              static_cast<float>(w2) * batch.inv_w[2][t]) / area;
+        }
+
+        // Depth test and write in submission order.
+        for (size_t t = 0; t < batch.count; ++t)
+        {
+            if (!batch.covered[t])
+                continue;
+            int cell = batch.cell[t];
+            if (coverage_counts)
+                ++coverage_counts[cell];
+            ++bin_stats.depth_tests;
+            if (batch.depth[t] > depth_buffer[cell])
+            {
+                depth_buffer[cell] = batch.depth[t];
+                char_buffer[cell] = batch.glyph[t];
+                color_buffer[cell] = batch.color[t];
+                int tile = (cell / width / HIZ_TILE) * tiles_x + (cell % width) / HIZ_TILE;
+                tile_near[tile] = std::max(tile_near[tile], batch.depth[t]);
+                tile_dirty[tile] = 1;
+                ++bin_stats.depth_writes;
+            }
+        }
+    }
+
+    // texture, if not null, is tri's TriangleTexture.
+    void rasterize(const ScreenTriangle &tri, const TriangleTexture *texture, const CellBounds &bounds,
+                   FrameStats &bin_stats)
+    {
+        if (texture && !texture->level)
+            texture = nullptr;
+        const int32_t half = SUBPIXEL_ONE / 2;
+        int minX = bounds.min_x, maxX = bounds.max_x, minY = bounds.min_y, maxY = bounds.max_y;
+
+        // Edge i is opposite vertex i, so its value weights that vertex.
+        const int i1[3] = {1, 2, 0}, i2[3] = {2, 0, 1};
+        int64_t step_x[3], step_y[3], bias[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            int32_t ax = tri.x[i1[i]], ay = tri.y[i1[i]], bx = tri.x[i2[i]], by = tri.y[i2[i]];
+            step_x[i] = -static_cast<int64_t>(by - ay) * SUBPIXEL_ONE;
+            step_y[i] = static_cast<int64_t>(bx - ax) * SUBPIXEL_ONE;
+            bias[i] = owns_edge(ax, ay, bx, by) ? 0 : -1;
+        }
+        float inv_area = 1.0f / static_cast<float>(edge(tri.x[0], tri.y[0], tri.x[1], tri.y[1], tri.x[2], tri.y[2]));
+
+        // Interpolated 1/w is a convex combination of the vertices' 1/w, so
+        // these bound every depth the triangle can write.
+        float tri_near = std::max({tri.inv_w[0], tri.inv_w[1], tri.inv_w[2]});
+        float tri_far = std::min({tri.inv_w[0], tri.inv_w[1], tri.inv_w[2]});
+        bool refresh = (maxX - minX + 1) * (maxY - minY + 1) >= HIZ_REFRESH_MIN_CELLS;
+
+        bool any_tile_visible = false;
+        for (int ty = minY / HIZ_TILE; ty <= maxY / HIZ_TILE; ++ty)
+        {
+            for (int tx = minX / HIZ_TILE; tx <= maxX / HIZ_TILE; ++tx)
+            {
+                int tile = ty * tiles_x + tx;
+                float far_value = refresh ? refresh_tile_far(tile) : tile_far[tile];
+                if (far_value >= tri_near && !coverage_counts)
+                {
+                    ++bin_stats.hiz_tiles_rejected;
+                    continue;
+                }
+                any_tile_visible = true;
+
+                // Every cell in the tile is behind the whole triangle, so the
+                // per-cell depth test can be skipped.
+                bool always_passes = tri_far > tile_near[tile];
+
+                int x0 = std::max(minX, tx * HIZ_TILE), x1 = std::min(maxX, tx * HIZ_TILE + HIZ_TILE - 1);
+                int y0 = std::max(minY, ty * HIZ_TILE), y1 = std::min(maxY, ty * HIZ_TILE + HIZ_TILE - 1);
+                int64_t px = static_cast<int64_t>(x0) * SUBPIXEL_ONE + half;
+                int64_t py = static_cast<int64_t>(y0) * SUBPIXEL_ONE + half;
+                int64_t row[3];
+                for (int i = 0; i < 3; ++i)
+                    row[i] = edge(tri.x[i1[i]], tri.y[i1[i]], tri.x[i2[i]], tri.y[i2[i]], px, py);
+
+                bool wrote = false;
+                for (int y = y0; y <= y1; ++y)
+                {
+                    int64_t e0 = row[0], e1 = row[1], e2 = row[2];
+                    for (int x = x0; x <= x1; ++x)
+                    {
+                        if (e0 + bias[0] >= 0 && e1 + bias[1] >= 0 && e2 + bias[2] >= 0)
+                        {
+                            if (coverage_counts)
+                                ++coverage_counts[y * width + x];
+                            float interpolated_inv_w =
+                                (static_cast<float>(e0) * tri.inv_w[0] + static_cast<float>(e1) * tri.inv_w[1] +
+                                 static_cast<float>(e2) * tri.inv_w[2]) * inv_area;
+
+                            ++bin_stats.depth_tests;
+                            if (always_passes || interpolated_inv_w > depth_buffer[y * width + x])
+                            {
+                                depth_buffer[y * width + x] = interpolated_inv_w;
+                                char_buffer[y * width + x] =
+                                    texture ? sample(*texture, e0, e1, e2, inv_area / interpolated_inv_w) : tri.glyph;
+                                color_buffer[y * width + x] = tri.color;
+                                tile_near[tile] = std::max(tile_near[tile], interpolated_inv_w);
+                                wrote = true;
+                                ++bin_stats.depth_writes;
+                            }
+                        }
+                        e0 += step_x[0];
+                        e1 += step_x[1];
+                        e2 += step_x[2];
+                    }
+                    for (int i = 0; i < 3; ++i)
+                        row[i] += step_y[i];
+                }
+                if (wrote)
+                    tile_dirty[tile] = 1;
+            }
+        }
+        if (!any_tile_visible)
+            ++bin_stats.hiz_triangles_rejected;
+    }
+};
+
+// --- Dynamic Resolution ---
+
+// What a ResolutionController trades for frame time: the grid size, or the
+// LOD selector's error bound in cells.
+enum class ResolutionMode
+{
+    Grid,
+    LodBias
+};
+
+bool parse_resolution_mode(const std::string &name, ResolutionMode *mode)
+{
+    if (name == "grid")
+        *mode = ResolutionMode::Grid;
+    else if (name == "lod")
+        *mode = ResolutionMode::LodBias;
+    else
+        return false;
+    return true;
+}
+
+// Holds a frame-time budget by adjusting a renderer between frames. The
+// measured cost is smoothed, and nothing changes while it stays inside a
+// dead band around the target: quality drops once the cost is OVER_BAND
+// above it but only rises once it is UNDER_BAND below, so a step up cannot
+// immediately overshoot and undo itself. After every change the controller
+// waits COOLDOWN_FRAMES for the new setting to show in the measurements.
+struct ResolutionController
+{
+    static constexpr float SMOOTHING = 0.2f;
+    static constexpr float OVER_BAND = 0.10f;
+    static constexpr float UNDER_BAND = 0.30f;
+    static const int COOLDOWN_FRAMES = 10;
+    static constexpr float MIN_GRID_SCALE = 0.25f;
+    static constexpr float MAX_LOD_BIAS = 16.0f;
+
+    ResolutionMode mode;
+    float target_ms;
+    int base_width, base_height;
+    float max_grid_scale;
+    float min_lod_bias;
+
+    float grid_scale = 1.0f;
+    double smoothed_ms = 0.0;
+    int cooldown = 0;
+    const char *decision = "hold";
+    size_t changes = 0;
+
+    // Grid mode scales between MIN_GRID_SCALE and max_grid_scale of the
+    // renderer's current size; LOD mode starts from its current bias.
+    ResolutionController(ResolutionMode mode, float target_ms, const AsciiRenderer &renderer, float max_grid_scale)
+        : mode(mode), target_ms(target_ms), base_width(renderer.width), base_height(renderer.height),
+          max_grid_scale(std::max(1.0f, max_grid_scale)), min_lod_bias(renderer.lod_error_cells)
+    {
+    }
+
+    // Feeds one frame's cost; returns true if the renderer was changed.
+    bool update(double cost_ms, AsciiRenderer &renderer)
+    {
+        smoothed_ms = smoothed_ms == 0.0 ? cost_ms : smoothed_ms + SMOOTHING * (cost_ms - smoothed_ms);
+        decision = "hold";
+        if (cooldown > 0)
+        {
+            --cooldown;
+            decision = "settle";
+            return false;
+        }
+        float ratio = target_ms / static_cast<float>(smoothed_ms);
+        if (ratio < 1.0f / (1.0f + OVER_BAND))
+            decision = "lower";
+        else if (ratio > 1.0f / (1.0f - UNDER_BAND))
+            decision = "raise";
+        else
+            return false;
+
+        // Raster cost grows with the cell count, so each grid axis moves by
+        // the square root of the ratio; the LOD bound moves by the ratio.
+        bool changed;
+        if (mode == ResolutionMode::Grid)
+        {
+            grid_scale *= std::max(0.8f, std::min(1.25f, std::sqrt(ratio)));
+            grid_scale = std::max(MIN_GRID_SCALE, std::min(max_grid_scale, grid_scale));
+            int w = std::max(1, static_cast<int>(std::lround(base_width * grid_scale)));
+            int h = std::max(1, static_cast<int>(std::lround(base_height * grid_scale)));
+            changed = w != renderer.pending_width || h != renderer.pending_height;
+            renderer.resize(w, h);
+        }
+        else
+        {
+            float bias = renderer.lod_error_cells / std::max(0.67f, std::min(1.5f, ratio));
+            bias = std::max(min_lod_bias, std::min(MAX_LOD_BIAS, bias));
+            changed = bias != renderer.lod_error_cells;
+            renderer.lod_error_cells = bias;
+        }
+        if (!changed)
+        {
+            decision = "limit";
+            return false;
+        }
+        ++changes;
+        cooldown = COOLDOWN_FRAMES;
+        return true;
+    }
+};
+
+void print_stats(const ResolutionController &controller, const AsciiRenderer &renderer)
+{
+    std::cerr << "  resolution " << (controller.mode == ResolutionMode::Grid ? "grid" : "lod")
+              << " cost " << controller.smoothed_ms << "ms target " << controller.target_ms << "ms "
+              << controller.decision << " | grid " << renderer.pending_width << "x" << renderer.pending_height
+              << " lod bias " << renderer.lod_error_cells << " changes " << controller.changes << "\n";
+}
+
+// --- Turntable Export ---
+
+enum class TurntableFormat
+{
+    Plain,     // Frames as text, each followed by a blank line
+    Asciicast, // asciicast v2: a JSON header line then one output event per frame
+    Rle        // "ARLE" header, then per frame a byte count and (run, char) pairs
+};
+
+bool parse_turntable_format(const std::string &name, TurntableFormat *format)
+{
+    if (name == "plain")
+        *format = TurntableFormat::Plain;
+    else if (name == "asciicast")
+        *format = TurntableFormat::Asciicast;
+    else if (name == "rle")
+        *format = TurntableFormat::Rle;
+    else
+        return false;
+    return true;
+}
+
+// File name extension for an exported stream.
+const char *turntable_extension(TurntableFormat format)
+{
+    switch (format)
+    {
+    case TurntableFormat::Asciicast:
+        return ".cast";
+    case TurntableFormat::Rle:
+        return ".rle";
+    default:
+        return ".txt";
+    }
+}
+
+// Width over height of a terminal cell, for exports that have no font.
+const float CELL_ASPECT = 0.5f;
+
+// Writes frames to a stream one at a time as they arrive, so an export
+// never holds more than the frames still in flight. Text formats can carry
+// cell colours as SGR escapes; the RLE format stays glyph-only.
+class TurntableWriter
+{
+public:
+    static constexpr float FPS = 30.0f;
+
+    TurntableWriter(std::ostream &out, TurntableFormat format, int width, int height, int frame_count,
+                    ColorMode color_mode = ColorMode::None)
+        : out(out), format(format), color_mode(color_mode), width(width), height(height)
+    {
+        if (format == TurntableFormat::Asciicast)
+        {
+            out << "{\"version\": 2, \"width\": " << width << ", \"height\": " << height
+                << ", \"env\": {\"TERM\": \"xterm-256color\"}}\n";
+        }
+        else if (format == TurntableFormat::Rle)
+        {
+            out.write("ARLE", 4);
+            write_u32(static_cast<uint32_t>(width));
+            write_u32(static_cast<uint32_t>(height));
+            write_u32(static_cast<uint32_t>(frame_count));
+        }
+        line.reserve(width * 2 + 16);
+    }
+
+    // colors, if given, holds an RGB565 colour per cell.
+    void write_frame(const char *cells, const uint16_t *colors = nullptr)
+    {
+        bool colored = colors && color_mode != ColorMode::None;
+        switch (format)
+        {
+        case TurntableFormat::Plain:
+            for (int y = 0; y < height; ++y)
+            {
+                write_row(cells + y * width, colored ? colors + y * width : nullptr, "\x1b[");
+                out.put('\n');
+            }
+            out.put('\n');
+            break;
+        case TurntableFormat::Asciicast:
+            // Home the cursor and repaint every row; glyphs never need
+            // escaping, only the control characters around them.
+            out << '[' << frames_written / FPS << ", \"o\", \"\\u001b[H";
+            for (int y = 0; y < height; ++y)
+            {
+                write_row(cells + y * width, colored ? colors + y * width : nullptr, "\\u001b[");
+                if (y + 1 < height)
+                    out << "\\r\\n";
+            }
+            out << "\"]\n";
+            break;
+        case TurntableFormat::Rle:
+            line.clear();
+            for (int i = 0, n = width * height; i < n;)
+            {
+                int run = 1;
+                while (i + run < n && run < 255 && cells[i + run] == cells[i])
+                    ++run;
+                line.push_back(static_cast<char>(run));
+                line.push_back(cells[i]);
+                i += run;
+            }
+            write_u32(static_cast<uint32_t>(line.size()));
+            out.write(line.data(), line.size());
+            break;
+        }
+        ++frames_written;
+    }
+
+private:
+    void write_row(const char *cells, const uint16_t *colors, const char *escape)
+    {
+        if (!colors)
+        {
+            out.write(cells, width);
+            return;
+        }
+        line.clear();
+        append_colored_row(line, cells, colors, width, color_mode, escape);
+        out.write(line.data(), line.size());
+    }
+
+    void write_u32(uint32_t value)
+    {
+        unsigned char bytes[4] = {static_cast<unsigned char>(value), static_cast<unsigned char>(value >> 8),
+                                  static_cast<unsigned char>(value >> 16), static_cast<unsigned char>(value >> 24)};
+        out.write(reinterpret_cast<const char *>(bytes), 4);
+    }
+
+    std::ostream &out;
+    TurntableFormat format;
+    ColorMode color_mode;
+    int width, height;
+    int frames_written = 0;
+    std::string line;
+};
+
+// A camera fitted to a model's bounding sphere, so the whole model stays in
+// frame at any rotation about its centre's vertical axis.
+struct TurntableCamera
+{
+    FrameView base;
+    Vec3 center;
+    float radius;
+    float distance;
+
+    static TurntableCamera fit(const Model &model, float fov_degrees, float aspect)
+    {
+        Vec3 lo = model.meshes.empty() ? Vec3{0, 0, 0} : model.meshes[0].bounds_min;
+        Vec3 hi = model.meshes.empty() ? Vec3{0, 0, 0} : model.meshes[0].bounds_max;
+        for (const Mesh &mesh : model.meshes)
+        {
+            const Vec3 &a = mesh.bounds_min, &b = mesh.bounds_max;
+            lo = {std::min(lo.x, a.x), std::min(lo.y, a.y), std::min(lo.z, a.z)};
+            hi = {std::max(hi.x, b.x), std::max(hi.y, b.y), std::max(hi.z, b.z)};
+        }
+        TurntableCamera camera;
+        camera.center = Vec3::scale(Vec3::add(lo, hi), 0.5f);
+        float radius = camera.radius = std::max(1e-3f, Vec3::length(Vec3::subtract(hi, lo)) * 0.5f);
+        float half_fov_y = static_cast<float>(fov_degrees * M_PI / 360.0f);
+        float half_fov_x = std::atan(std::tan(half_fov_y) * aspect);
+        camera.distance = radius / std::sin(std::min(half_fov_x, half_fov_y)) * 1.05f;
+
+        camera.base.view_matrix = Mat4::lookAt({0.0f, 0.0f, camera.distance}, {0.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f});
+        camera.base.projection_matrix =
+            Mat4::perspective(fov_degrees, aspect, std::max(camera.distance - radius * 1.1f, camera.distance * 0.01f),
+                              camera.distance + radius * 1.1f);
+        camera.base.light_direction = Vec3::normalize({0.5f, -1.0f, -1.0f});
+        return camera;
+    }
+
+    // The model is moved to the origin and spun; back-face culling happens
+    // in model space, so the camera is spun the opposite way to match.
+    FrameView at(float angle) const
+    {
+        FrameView view = base;
+        view.model_matrix =
+            Mat4::multiply(Mat4::create_rotation_y(angle), Mat4::create_translation(Vec3::scale(center, -1.0f)));
+        Vec4 eye = Mat4::create_rotation_y(-angle).transform({0.0f, 0.0f, distance, 1.0f});
+        view.camera_pos = Vec3::add(center, {eye.x, eye.y, eye.z});
+        return view;
+    }
+};
+
+// Renders frame_count frames over one full turn and streams them to out in
+// order. Each worker thread draws whole frames with its own renderer and
+// parks them in a ring of finished frames; workers may run ahead of the
+// writer by at most the ring's size, which bounds memory for any length.
+bool render_turntable(const Model &model, int width, int height, int frame_count, TurntableFormat format,
+                      ColorMode color_mode, std::ostream &out, int thread_count, bool use_lods,
+                      bool sort_front_to_back, const Bvh *bvh = nullptr, RenderPath render_path = RenderPath::Raster)
+{
+    TurntableCamera camera = TurntableCamera::fit(model, 60.0f, width * CELL_ASPECT / height);
+    TurntableWriter writer(out, format, width, height, frame_count, color_mode);
+    bool colored = color_mode != ColorMode::None;
+
+    int workers = std::max(1, std::min(thread_count, frame_count));
+    const int ring_size = workers * 2;
+    std::vector<std::vector<char>> ring(ring_size, std::vector<char>(width * height));
+    std::vector<std::vector<uint16_t>> ring_colors(ring_size, std::vector<uint16_t>(colored ? width * height : 0));
+    std::vector<int> ring_frame(ring_size, -1);
+    std::mutex ring_lock;
+    std::condition_variable ring_changed;
+    int next_frame = 0, frames_written = 0;
+
+    auto worker_main = [&]() {
+        AsciiRenderer renderer(width, height);
+        renderer.use_lods = use_lods;
+        renderer.sort_front_to_back = sort_front_to_back;
+        renderer.render_path = render_path;
+        for (;;)
+        {
+            int frame;
+            {
+                std::lock_guard<std::mutex> lock(ring_lock);
+                if (next_frame == frame_count)
+                    return;
+                frame = next_frame++;
+            }
+            renderer.draw(model, camera.at(static_cast<float>(2.0 * M_PI * frame / frame_count)), bvh);
+            {
+                std::unique_lock<std::mutex> lock(ring_lock);
+                ring_changed.wait(lock, [&] { return frame < frames_written + ring_size; });
+                int slot = frame % ring_size;
+                std::copy(renderer.char_buffer.begin(), renderer.char_buffer.end(), ring[slot].begin());
+                if (colored)
+                    std::copy(renderer.color_buffer.begin(), renderer.color_buffer.end(), ring_colors[slot].begin());
+                ring_frame[slot] = frame;
+            }
+            ring_changed.notify_all();
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < workers; ++i)
+        threads.emplace_back(worker_main);
+    for (int frame = 0; frame < frame_count; ++frame)
+    {
+        int slot = frame % ring_size;
+        {
+            std::unique_lock<std::mutex> lock(ring_lock);
+            ring_changed.wait(lock, [&] { return ring_frame[slot] == frame; });
+        }
+        // The slot is not reused until frames_written moves past it.
+        writer.write_frame(ring[slot].data(), colored ? ring_colors[slot].data() : nullptr);
+        {
+            std::lock_guard<std::mutex> lock(ring_lock);
+            ++frames_written;
+        }
+        ring_changed.notify_all();
+    }
+    for (std::thread &t : threads)
+        t.join();
+    out.flush();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "turntable: " << frame_count << " frames in " << seconds << "s (" << frame_count / seconds
+              << " fps) on " << workers << " threads" << std::endl;
+    return static_cast<bool>(out);
+}
+
+// --- Batch Rendering ---
+
+// Expands a batch source: a directory yields the .obj files in it, sorted
+// by name; any other file is read as a list with one path per line.
+bool collect_batch_inputs(const std::string &source, std::vector<std::string> *paths)
+{
+    std::error_code ec;
+    if (std::filesystem::is_directory(source, ec))
+    {
+        for (const auto &entry : std::filesystem::directory_iterator(source, ec))
+            if (entry.is_regular_file() && entry.path().extension() == ".obj")
+                paths->push_back(entry.path().string());
+        std::sort(paths->begin(), paths->end());
+        return !ec;
+    }
+    std::ifstream list(source);
+    if (!list)
+        return false;
+    std::string line;
+    while (std::getline(list, line))
+    {
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' '))
+            line.pop_back();
+        if (!line.empty() && line[0] != '#')
+            paths->push_back(line);
+    }
+    return true;
+}
+
+// Renders each model to out_dir/<name><extension>, frame_count frames over
+// a full turn. Loader threads read and prepare models concurrently, at most
+// a few ahead of the renderer, while a single renderer and its thread pool
+// draw them in order; writing a frame overlaps drawing the next. Returns
+// false if any model failed.
+bool render_batch(const std::vector<std::string> &paths, const std::string &out_dir, int width, int height,
+                  int frame_count, TurntableFormat format, ColorMode color_mode, int thread_count, bool pin_threads,
+                  bool use_lods, bool compact, bool sort_front_to_back)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(out_dir, ec);
+    if (ec)
+    {
+        std::cerr << "Failed to create " << out_dir << ": " << ec.message() << std::endl;
+        return false;
+    }
+
+    struct LoadedModel
+    {
+        Model model;
+        bool ok;
+        std::string error;
+    };
+    const size_t count = paths.size();
+    const size_t loaders = std::max<size_t>(1, std::min<size_t>(thread_count, count));
+    const size_t window = loaders * 2;
+    std::vector<std::unique_ptr<LoadedModel>> loaded(count);
+    std::mutex load_lock;
+    std::condition_variable load_changed;
+    size_t next_load = 0, rendered = 0;
+
+    auto loader_main = [&]() {
+        for (;;)
+        {
+            size_t i;
+            {
+                std::unique_lock<std::mutex> lock(load_lock);
+                if (next_load == count)
+                    return;
+                i = next_load++;
+                load_changed.wait(lock, [&] { return i < rendered + window; });
+            }
+            std::unique_ptr<LoadedModel> result(new LoadedModel());
+            std::pair<float, float> acmr;
+            result->ok = load_model(paths[i], use_lods, compact, &result->model, &acmr, &result->error);
+            {
+                std::lock_guard<std::mutex> lock(load_lock);
+                loaded[i] = std::move(result);
+            }
+            load_changed.notify_all();
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < loaders; ++i)
+        threads.emplace_back(loader_main);
+
+    AsciiRenderer renderer(width, height, thread_count, pin_threads);
+    renderer.use_lods = use_lods;
+    renderer.sort_front_to_back = sort_front_to_back;
+    size_t failed = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        std::unique_ptr<LoadedModel> item;
+        {
+            std::unique_lock<std::mutex> lock(load_lock);
+            load_changed.wait(lock, [&] { return loaded[i] != nullptr; });
+            item = std::move(loaded[i]);
+        }
+
+        std::string out_path =
+            (std::filesystem::path(out_dir) / std::filesystem::path(paths[i]).stem()).string() +
+            turntable_extension(format);
+        std::ofstream out(out_path, std::ios::binary);
+        if (!item->ok || !out)
+        {
+            std::cerr << paths[i] << ": " << (item->ok ? "failed to open " + out_path : item->error) << std::endl;
+            ++failed;
+        }
+        else
+        {
+            TurntableCamera camera = TurntableCamera::fit(item->model, 60.0f, width * CELL_ASPECT / height);
+            TurntableWriter writer(out, format, width, height, frame_count, color_mode);
+            renderer.begin_draw(item->model, camera.at(0.0f));
+            for (int frame = 0; frame < frame_count; ++frame)
+            {
+                renderer.finish_draw();
+                if (frame + 1 < frame_count)
+                    renderer.begin_draw(item->model,
+                                        camera.at(static_cast<float>(2.0 * M_PI * (frame + 1) / frame_count)));
+                writer.write_frame(renderer.finished_char_buffer().data(), renderer.finished_color_buffer().data());
+            }
+            if (!out.flush())
+            {
+                std::cerr << paths[i] << ": failed to write " << out_path << std::endl;
+                ++failed;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(load_lock);
+            ++rendered;
+        }
+        load_changed.notify_all();
+    }
+    for (std::thread &t : threads)
+        t.join();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "batch: " << count - failed << " of " << count << " models in " << seconds << "s ("
+              << (count - failed) / seconds << " models/s)" << std::endl;
+    return failed == 0;
+}
+
+// --- Render Server ---
+
+// Models shared by the server's workers, evicting the least recently used
+// beyond capacity. Entries are keyed by path and revalidated against the
+// file's size and mtime on every lookup, so edited files are reloaded.
+// Workers holding an evicted model keep it alive until they finish.
+class ModelCache
+{
+public:
+    ModelCache(size_t capacity, bool use_lods, bool compact)
+        : capacity(std::max<size_t>(1, capacity)), use_lods(use_lods), compact(compact)
+    {
+    }
+
+    std::shared_ptr<const Model> get(const std::string &path, bool *hit, std::string *error)
+    {
+        FileStamp stamp;
+        if (!stat_file(path, &stamp))
+        {
+            *error = "cannot stat " + path;
+            return nullptr;
+        }
+        std::unique_lock<std::mutex> guard(lock);
+        // Only one worker loads a given path; others wait for its result.
+        loaded.wait(guard, [&] { return loading.count(path) == 0; });
+        auto it = entries.find(path);
+        if (it != entries.end() && it->second.stamp.size == stamp.size && it->second.stamp.mtime == stamp.mtime)
+        {
+            order.splice(order.begin(), order, it->second.position);
+            ++hits;
+            *hit = true;
+            return it->second.model;
+        }
+        ++misses;
+        *hit = false;
+        loading.insert(path);
+        guard.unlock();
+
+        // Load without the lock so other models stay available meanwhile.
+        std::shared_ptr<Model> model = std::make_shared<Model>();
+        std::pair<float, float> acmr;
+        bool ok = load_model(path, use_lods, compact, model.get(), &acmr, error);
+
+        guard.lock();
+        loading.erase(path);
+        loaded.notify_all();
+        if (!ok)
+            return nullptr;
+        it = entries.find(path);
+        if (it != entries.end())
+            order.erase(it->second.position);
+        order.push_front(path);
+        entries[path] = {stamp, model, order.begin()};
+        while (entries.size() > capacity)
+        {
+            entries.erase(order.back());
+            order.pop_back();
+        }
+        return model;
+    }
+
+    void counters(size_t *hit_count, size_t *miss_count, size_t *size)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        *hit_count = hits;
+        *miss_count = misses;
+        *size = entries.size();
+    }
+
+private:
+    struct Entry
+    {
+        FileStamp stamp;
+        std::shared_ptr<const Model> model;
+        std::list<std::string>::iterator position;
+    };
+
+    size_t capacity;
+    bool use_lods;
+    bool compact;
+    std::mutex lock;
+    std::condition_variable loaded;
+    std::unordered_set<std::string> loading;
+    std::list<std::string> order; // Most recently used first
+    std::unordered_map<std::string, Entry> entries;
+    size_t hits = 0, misses = 0;
+};
+
+// One RENDER line: space-separated key=value fields, where ramp, if
+// present, must come last and takes the rest of the line so it can
+// contain spaces. Without eye the camera orbits the fitted turntable
+// position by yaw degrees.
+struct RenderRequest
+{
+    static const int MAX_GRID = 1024;
+
+    std::string model;
+    int width = 80, height = 40;
+    float yaw = 0.0f; // Degrees about the vertical axis
+    float fov = 60.0f;
+    bool has_eye = false, has_target = false;
+    Vec3 eye, target;
+    std::string ramp = DEFAULT_RAMP;
+
+    static bool parse_vec3(const std::string &text, Vec3 *v)
+    {
+        return std::sscanf(text.c_str(), "%f,%f,%f", &v->x, &v->y, &v->z) == 3;
+    }
+
+    static bool parse(const std::string &line, RenderRequest *request, std::string *error)
+    {
+        size_t pos = line.find(' ');
+        while (pos != std::string::npos)
+        {
+            size_t start = pos + 1;
+            if (line.compare(start, 5, "ramp=") == 0)
+            {
+                request->ramp = line.substr(start + 5);
+                break;
+            }
+            pos = line.find(' ', start);
+            std::string field = line.substr(start, pos == std::string::npos ? std::string::npos : pos - start);
+            if (field.empty())
+                continue;
+            size_t eq = field.find('=');
+            std::string key = field.substr(0, eq), value = eq == std::string::npos ? "" : field.substr(eq + 1);
+            bool ok = true;
+            if (key == "model")
+                request->model = value;
+            else if (key == "width")
+                ok = (request->width = std::atoi(value.c_str())) > 0;
+            else if (key == "height")
+                ok = (request->height = std::atoi(value.c_str())) > 0;
+            else if (key == "yaw")
+                request->yaw = static_cast<float>(std::atof(value.c_str()));
+            else if (key == "fov")
+                ok = (request->fov = static_cast<float>(std::atof(value.c_str()))) > 0.0f && request->fov < 180.0f;
+            else if (key == "eye")
+                ok = request->has_eye = parse_vec3(value, &request->eye);
+            else if (key == "target")
+                ok = request->has_target = parse_vec3(value, &request->target);
+            else
+                ok = false;
+            if (!ok)
+            {
+                *error = "bad field " + field;
+                return false;
+            }
+        }
+        if (request->model.empty())
+            *error = "missing model";
+        else if (request->width > MAX_GRID || request->height > MAX_GRID)
+            *error = "grid larger than " + std::to_string(MAX_GRID);
+        else if (request->ramp.empty())
+            *error = "empty ramp";
+        else
+            return true;
+        return false;
+    }
+};
+
+// Long-running server on a Unix domain socket. Each connection sends
+// newline-terminated requests and gets one response per line:
+//   RENDER model=PATH [width=W] [height=H] [yaw=DEG] [fov=DEG]
+//          [eye=X,Y,Z] [target=X,Y,Z] [ramp=GLYPHS]
+//     -> "OK W H <render_us> <hit|miss>" then H rows of W glyphs
+//   STATS -> "OK" and counters plus latency percentiles on one line
+// Failures answer "ERR <reason>". The main thread polls every connection
+// and hands complete request lines, one per connection at a time so
+// responses keep their order, to a fixed pool of workers through a
+// bounded queue; a request that finds it full is answered "ERR busy".
+// Idle connections cost no worker and are closed after IDLE_TIMEOUT_MS.
+// Latency runs from a request being picked up to its response being
+// sent; queue time, from being read to being picked up, is tracked
+// separately.
+class RenderServer
+{
+public:
+    RenderServer(int worker_count, size_t queue_capacity, size_t cache_capacity, bool use_lods, bool compact,
+                 bool sort_front_to_back)
+        : worker_count(std::max(1, worker_count)), queue_capacity(std::max<size_t>(1, queue_capacity)),
+          cache(cache_capacity, use_lods, compact), sort_front_to_back(sort_front_to_back)
+    {
+    }
+
+    // Serves until the process is killed; returns only on setup failure.
+    bool run(const std::string &socket_path)
+    {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(address.sun_path))
+        {
+            std::cerr << "Socket path too long: " << socket_path << std::endl;
+            return false;
+        }
+        std::strcpy(address.sun_path, socket_path.c_str());
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(socket_path.c_str()); // Stale socket from a previous run
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+            listen(listener, 64) != 0 || pipe(wake_pipe) != 0)
+        {
+            std::cerr << "Failed to listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+            if (listener >= 0)
+                close(listener);
+            return false;
+        }
+        fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+        signal(SIGPIPE, SIG_IGN); // Clients hanging up surface as write errors instead
+
+        std::vector<std::thread> workers;
+        for (int i = 0; i < worker_count; ++i)
+            workers.emplace_back(&RenderServer::worker_main, this);
+        std::cerr << "serving on " << socket_path << " with " << worker_count << " workers" << std::endl;
+
+        std::vector<std::shared_ptr<Connection>> connections;
+        std::vector<pollfd> polled;
+        for (;;)
+        {
+            // Busy connections aren't read, so a client's further requests
+            // wait in its socket until the one in flight is answered.
+            int timeout_ms = IDLE_TIMEOUT_MS;
+            polled.assign({{listener, POLLIN, 0}, {wake_pipe[0], POLLIN, 0}});
+            for (const std::shared_ptr<Connection> &connection : connections)
+            {
+                std::lock_guard<std::mutex> guard(queue_lock);
+                short events = connection->busy ? 0 : POLLIN;
+                polled.push_back({connection->hung_up ? -1 : connection->fd, events, 0});
+                if (!connection->busy)
+                {
+                    int idle_ms = static_cast<int>(elapsed_us(connection->last_active) / 1000);
+                    timeout_ms = std::min(timeout_ms, std::max(0, IDLE_TIMEOUT_MS - idle_ms));
+                }
+            }
+            if (poll(polled.data(), polled.size(), timeout_ms) < 0 && errno != EINTR)
+                std::cerr << "poll: " << std::strerror(errno) << std::endl;
+
+            char drained[64];
+            while (read(wake_pipe[0], drained, sizeof(drained)) > 0)
+            {
+            }
+            if (polled[0].revents & POLLIN)
+                accept_connection(listener, &connections);
+
+            for (size_t i = 0; i < connections.size(); ++i)
+            {
+                Connection &connection = *connections[i];
+                bool readable = polled.size() > i + 2 && polled[i + 2].fd == connection.fd &&
+                                (polled[i + 2].revents & (POLLIN | POLLHUP | POLLERR));
+                if (readable && !receive(connection))
+                    connection.hung_up = true;
+                dispatch(connections[i]);
+            }
+            connections.erase(std::remove_if(connections.begin(), connections.end(),
+                                             [&](const std::shared_ptr<Connection> &connection) {
+                                                 std::lock_guard<std::mutex> guard(queue_lock);
+                                                 if (connection->busy)
+                                                     return false;
+                                                 // Lines sent before a hang-up are still answered.
+                                                 bool drained = connection->hung_up &&
+                                                                connection->pending.find('\n') == std::string::npos;
+                                                 if (!connection->closing && !drained &&
+                                                     elapsed_us(connection->last_active) < IDLE_TIMEOUT_MS * 1000.0)
+                                                     return false;
+                                                 close(connection->fd);
+                                                 return true;
+                                             }),
+                              connections.end());
+        }
+    }
+
+private:
+    // Owned by the main thread except for busy, closing and last_active,
+    // which a worker serving one of its requests also touches; all three
+    // are guarded by queue_lock.
+    struct Connection
+    {
+        int fd;
+        std::string pending;  // Bytes read but not yet dispatched
+        bool busy = false;    // A request from it is queued or being served
+        bool hung_up = false; // Nothing more to read; set on EOF, errors and overlong lines
+        bool closing = false;
+        std::chrono::steady_clock::time_point last_active;
+    };
+
+    struct Request
+    {
+        std::shared_ptr<Connection> connection;
+        std::string line;
+        std::chrono::steady_clock::time_point received;
+    };
+
+    static const size_t LATENCY_WINDOW = 4096; // Percentiles cover the most recent requests
+    static const size_t MAX_LINE = 4096;
+    static const size_t MAX_CONNECTIONS = 1024;
+    static const int IDLE_TIMEOUT_MS = 30000;
+    static const int SEND_TIMEOUT_MS = 10000; // A client that stops reading can't hold a worker longer
+
+    static double elapsed_us(std::chrono::steady_clock::time_point since)
+    {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - since).count();
+    }
+
+    static bool send_all(int fd, const std::string &data)
+    {
+        for (size_t sent = 0; sent < data.size();)
+        {
+            ssize_t n = write(fd, data.data() + sent, data.size() - sent);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            sent += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    void accept_connection(int listener, std::vector<std::shared_ptr<Connection>> *connections)
+    {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0)
+        {
+            if (errno != EINTR && errno != EAGAIN)
+                std::cerr << "accept: " << std::strerror(errno) << std::endl;
+            return;
+        }
+        if (connections->size() >= MAX_CONNECTIONS)
+        {
+            ++rejected;
+            send_all(fd, "ERR busy\n");
+            close(fd);
+            return;
+        }
+        // Reads only follow poll() reporting data, so the receive timeout is
+        // a backstop; idleness between requests is timed by the poll loop.
+        timeval receive_timeout = {IDLE_TIMEOUT_MS / 1000, IDLE_TIMEOUT_MS % 1000 * 1000};
+        timeval send_timeout = {SEND_TIMEOUT_MS / 1000, SEND_TIMEOUT_MS % 1000 * 1000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &receive_timeout, sizeof(receive_timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+        std::shared_ptr<Connection> connection = std::make_shared<Connection>();
+        connection->fd = fd;
+        connection->last_active = std::chrono::steady_clock::now();
+        connections->push_back(connection);
+    }
+
+    // Reads what the connection has ready; false once it hangs up, fails
+    // or sends a line longer than MAX_LINE.
+    static bool receive(Connection &connection)
+    {
+        char buffer[4096];
+        ssize_t n = read(connection.fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            return true;
+        if (n <= 0)
+            return false;
+        connection.pending.append(buffer, static_cast<size_t>(n));
+        connection.last_active = std::chrono::steady_clock::now();
+        return connection.pending.size() <= MAX_LINE || connection.pending.find('\n') != std::string::npos;
+    }
+
+    // Queues the connection's next complete line unless one of its
+    // requests is already in flight.
+    void dispatch(const std::shared_ptr<Connection> &connection)
+    {
+        for (;;)
+        {
+            size_t end = connection->pending.find('\n');
+            if (end == std::string::npos)
+                return;
+            Request request{connection, connection->pending.substr(0, end), std::chrono::steady_clock::now()};
+            if (!request.line.empty() && request.line.back() == '\r')
+                request.line.pop_back();
+            {
+                std::lock_guard<std::mutex> guard(queue_lock);
+                if (connection->busy || connection->closing)
+                    return;
+                connection->pending.erase(0, end + 1);
+                if (queue.size() < queue_capacity)
+                {
+                    connection->busy = true;
+                    queue.push_back(std::move(request));
+                }
+                else
+                    ++rejected;
+            }
+            if (connection->busy)
+            {
+                queue_ready.notify_one();
+                return;
+            }
+            if (!send_all(connection->fd, "ERR busy\n"))
+            {
+                std::lock_guard<std::mutex> guard(queue_lock);
+                connection->closing = true;
+            }
+        }
+    }
+
+    void worker_main()
+    {
+        std::unique_ptr<AsciiRenderer> renderer;
+        for (;;)
+        {
+            Request request;
+            {
+                std::unique_lock<std::mutex> guard(queue_lock);
+                queue_ready.wait(guard, [&] { return !queue.empty(); });
+                request = std::move(queue.front());
+                queue.pop_front();
+            }
+            record(queue_latencies, elapsed_us(request.received));
+
+            auto start = std::chrono::steady_clock::now();
+            std::string response = handle(request.line, renderer);
+            bool sent = send_all(request.connection->fd, response);
+            if (sent)
+                record(latencies, elapsed_us(start));
+            {
+                std::lock_guard<std::mutex> guard(queue_lock);
+                request.connection->busy = false;
+                request.connection->closing |= !sent;
+                request.connection->last_active = std::chrono::steady_clock::now();
+            }
+            char wake = 0;
+            (void)!write(wake_pipe[1], &wake, 1); // The main thread may have its next line ready
+        }
+    }
+
+    std::string handle(const std::string &line, std::unique_ptr<AsciiRenderer> &renderer)
+    {
+        ++requests;
+        if (line == "STATS")
+            return stats_line();
+        if (line.compare(0, 7, "RENDER ") != 0)
+        {
+            ++errors;
+            return "ERR unknown request\n";
+        }
+
+        RenderRequest request;
+        std::string error;
+        bool hit = false;
+        std::shared_ptr<const Model> model;
+        if (!RenderRequest::parse(line, &request, &error) || !(model = cache.get(request.model, &hit, &error)))
+        {
+            ++errors;
+            std::replace(error.begin(), error.end(), '\n', ' ');
+            return "ERR " + error + "\n";
+        }
+
+        // Each worker keeps its own single-threaded renderer, rebuilt only
+        // when the grid size changes.
+        if (!renderer || renderer->width != request.width || renderer->height != request.height)
+        {
+            renderer.reset(new AsciiRenderer(request.width, request.height));
+            renderer->sort_front_to_back = sort_front_to_back;
+        }
+        renderer->use_lods = !model->meshes.empty() && model->meshes[0].lods.size() > 1;
+        renderer->ramp = request.ramp;
+
+        auto start = std::chrono::steady_clock::now();
+        float aspect = request.width * CELL_ASPECT / request.height;
+        TurntableCamera camera = TurntableCamera::fit(*model, request.fov, aspect);
+        float yaw = static_cast<float>(request.yaw * M_PI / 180.0);
+        FrameView view = camera.at(yaw);
+        if (request.has_eye)
+        {
+            // Explicit cameras are in model space; the model still spins by
+            // yaw about its origin.
+            Vec3 target = request.has_target ? request.target : camera.center;
+            float reach = Vec3::length(Vec3::subtract(request.eye, camera.center)) + camera.radius * 1.1f;
+            view.model_matrix = Mat4::create_rotation_y(yaw);
+            view.view_matrix = Mat4::lookAt(request.eye, target, {0.0f, 1.0f, 0.0f});
+            view.projection_matrix = Mat4::perspective(request.fov, aspect, reach * 0.001f, reach);
+            Vec4 eye = Mat4::create_rotation_y(-yaw).transform({request.eye.x, request.eye.y, request.eye.z, 1.0f});
+            view.camera_pos = {eye.x, eye.y, eye.z};
+        }
+        renderer->draw(*model, view);
+
+        std::string response = "OK " + std::to_string(request.width) + " " + std::to_string(request.height) + " " +
+                               std::to_string(static_cast<long>(elapsed_us(start))) + (hit ? " hit\n" : " miss\n");
+        response.reserve(response.size() + (request.width + 1) * request.height);
+        for (int y = 0; y < request.height; ++y)
+        {
+            response.append(renderer->char_buffer.data() + y * request.width, request.width);
+            response.push_back('\n');
+        }
+        return response;
+    }
+
+    struct LatencyLog
+    {
+        std::mutex lock;
+        std::vector<double> samples;
+        size_t next = 0;
+    };
+
+    void record(LatencyLog &log, double us)
+    {
+        std::lock_guard<std::mutex> guard(log.lock);
+        if (log.samples.size() < LATENCY_WINDOW)
+            log.samples.push_back(us);
+        else
+            log.samples[log.next] = us;
+        log.next = (log.next + 1) % LATENCY_WINDOW;
+    }
+
+    static std::string percentiles(LatencyLog &log, const char *prefix)
+    {
+        std::vector<double> samples;
+        {
+            std::lock_guard<std::mutex> guard(log.lock);
+            samples = log.samples;
+        }
+        std::string out;
+        const double points[] = {0.5, 0.95, 0.99, 1.0};
+        const char *names[] = {"p50", "p95", "p99", "max"};
+        for (int i = 0; i < 4; ++i)
+        {
+            double value = 0.0;
+            if (!samples.empty())
+            {
+                size_t k = std::min(samples.size() - 1, static_cast<size_t>(points[i] * samples.size()));
+                std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+                value = samples[k];
+            }
+            out += std::string(" ") + prefix + names[i] + "_us=" + std::to_string(static_cast<long>(value));
+        }
+        return out;
+    }
+
+    std::string stats_line()
+    {
+        size_t hits, misses, cached, queued;
+        cache.counters(&hits, &misses, &cached);
+        {
+            std::lock_guard<std::mutex> guard(queue_lock);
+            queued = queue.size();
+        }
+        return "OK requests=" + std::to_string(requests.load()) + " errors=" + std::to_string(errors.load()) +
+               " rejected=" + std::to_string(rejected.load()) + " queued=" + std::to_string(queued) +
+               " cache_hits=" + std::to_string(hits) + " cache_misses=" + std::to_string(misses) +
+               " cached=" + std::to_string(cached) + percentiles(latencies, "") +
+               percentiles(queue_latencies, "queue_") + "\n";
+    }
+
+    int worker_count;
+    size_t queue_capacity;
+    ModelCache cache;
+    bool sort_front_to_back;
+    std::mutex queue_lock;
+    std::condition_variable queue_ready;
+    std::deque<Request> queue;
+    int wake_pipe[2] = {-1, -1}; // Workers nudge the main thread's poll() through it
+    std::atomic<size_t> requests{0}, errors{0}, rejected{0};
+    LatencyLog latencies, queue_latencies;
+};
+
+// --- Glyph Compositor ---
+
+// Glyph coverage as 8-bit alpha, one cell-sized tile per character with its
+// rows stored contiguously, plus the ARGB tint each glyph is drawn in.
+struct GlyphAtlas
+{
+    int cell_width, cell_height;
+    std::vector<uint8_t> alpha;
+    int tile[256];
+    uint32_t tint[256];
+
+    GlyphAtlas(int cell_width, int cell_height) : cell_width(cell_width), cell_height(cell_height)
+    {
+        std::fill(tile, tile + 256, -1);
+        std::fill(tint, tint + 256, 0xFFFFFFFFu);
+    }
+
+    // Copies a glyph from ARGB8888 pixels, keeping only alpha, clipped or
+    // padded to the cell.
+    void add(char c, const uint32_t *pixels, int pitch, int w, int h, uint32_t argb)
+    {
+        size_t base = alpha.size();
+        alpha.resize(base + cell_width * cell_height, 0);
+        for (int y = 0; y < std::min(h, cell_height); ++y)
+        {
+            const uint32_t *row =
+                reinterpret_cast<const uint32_t *>(reinterpret_cast<const uint8_t *>(pixels) + y * pitch);
+            for (int x = 0; x < std::min(w, cell_width); ++x)
+                alpha[base + y * cell_width + x] = static_cast<uint8_t>(row[x] >> 24);
+        }
+        tile[static_cast<unsigned char>(c)] = static_cast<int>(base / (cell_width * cell_height));
+        tint[static_cast<unsigned char>(c)] = argb;
+    }
+
+    const uint8_t *glyph(char c) const
+    {
+        int t = tile[static_cast<unsigned char>(c)];
+        return t < 0 ? nullptr : &alpha[t * cell_width * cell_height];
+    }
+};
+
+// Draws a character grid into an ARGB8888 framebuffer on the CPU, for SDL
+// renderers without acceleration. Each pixel row of a row of cells is first
+// assembled as a strip of coverage, one memcpy per glyph, and a strip of
+// tints; one SIMD pass then turns the whole strip into pixels.
+class GlyphCompositor
+{
+public:
+    explicit GlyphCompositor(const GlyphAtlas &atlas) : atlas(atlas) {}
+
+    // Sizes the framebuffer for a grid; returns true if its size changed.
+    bool resize(int grid_columns, int grid_rows)
+    {
+        if (grid_columns == columns && grid_rows == rows)
+            return false;
+        columns = grid_columns;
+        rows = grid_rows;
+        framebuffer.assign(static_cast<size_t>(width()) * height(), 0xFF000000u);
+        alpha_strip.resize(width());
+        tint_strip.resize(width());
+        row_glyphs.resize(columns);
+        return true;
+    }
+
+    // Composites a row-major grid of cells. Each cell is tinted with its
+    // RGB565 colors[i], or with its glyph's atlas tint if colors is null.
+    void compose(const char *cells, const uint16_t *colors)
+    {
+        AllocationTracking tracking;
+        int cw = atlas.cell_width;
+        for (int row = 0; row < rows; ++row)
+        {
+            const char *line = cells + row * columns;
+            for (int col = 0; col < columns; ++col)
+            {
+                row_glyphs[col] = atlas.glyph(line[col]);
+                uint32_t tint = colors ? rgb565_to_argb(colors[row * columns + col])
+                                       : atlas.tint[static_cast<unsigned char>(line[col])];
+                std::fill(&tint_strip[col * cw], &tint_strip[col * cw] + cw, tint);
+            }
+            for (int y = 0; y < atlas.cell_height; ++y)
+            {
+                for (int col = 0; col < columns; ++col)
+                {
+                    if (row_glyphs[col])
+                        std::memcpy(&alpha_strip[col * cw], row_glyphs[col] + y * cw, cw);
+                    else
+                        std::memset(&alpha_strip[col * cw], 0, cw);
+                }
+                shade(alpha_strip.data(), tint_strip.data(), &framebuffer[(row * atlas.cell_height + y) * width()],
+                      width());
+            }
+        }
+    }
+
+    const uint32_t *pixels() const { return framebuffer.data(); }
+    int width() const { return columns * atlas.cell_width; }
+    int height() const { return rows * atlas.cell_height; }
+    int pitch() const { return width() * 4; }
+
+private:
+    // out = tint * alpha / 255 per channel, opaque over black.
+    static void shade(const uint8_t *alpha, const uint32_t *tint, uint32_t *out, int count)
+    {
+        int i = 0;
+#if defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i round = _mm_set1_epi16(128);
+        const __m128i opaque = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+        for (; i + 4 <= count; i += 4)
+        {
+            int32_t packed;
+            std::memcpy(&packed, alpha + i, 4);
+            __m128i a = _mm_cvtsi32_si128(packed);
+            a = _mm_unpacklo_epi8(a, a);
+            a = _mm_unpacklo_epi16(a, a); // Each alpha repeated over its pixel's four channels
+            __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tint + i));
+            __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(t, zero), _mm_unpacklo_epi8(a, zero));
+            __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(t, zero), _mm_unpackhi_epi8(a, zero));
+            lo = _mm_add_epi16(lo, round); // Rounded division by 255, as in the scalar loop
+            hi = _mm_add_epi16(hi, round);
+            lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+            hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_or_si128(_mm_packus_epi16(lo, hi), opaque));
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            uint32_t pixel = 0xFF000000u;
+            for (int shift = 0; shift < 24; shift += 8)
+            {
+                uint32_t c = ((tint[i] >> shift) & 0xFF) * alpha[i] + 128;
+                pixel |= ((c + (c >> 8)) >> 8) << shift;
+            }
+            out[i] = pixel;
+        }
+    }
+
+    const GlyphAtlas &atlas;
+    int columns = 0, rows = 0;
+    std::vector<uint32_t> framebuffer;
+    std::vector<uint8_t> alpha_strip;
+    std::vector<uint32_t> tint_strip;
+    std::vector<const uint8_t *> row_glyphs;
+};
+
+// --- Self Test ---
+
+// Writes a UV sphere, a closed convex mesh, as OBJ. flipped reverses the
+// winding, so the faces otherwise culled are drawn instead.
+void write_sphere_obj(std::ostream &out, int slices, int stacks, bool flipped)
+{
+    out << "v 0 1 0\n";
+    for (int i = 1; i < stacks; ++i)
+    {
+        double phi = M_PI * i / stacks;
+        for (int j = 0; j < slices; ++j)
+        {
+            double theta = 2.0 * M_PI * j / slices;
+            out << "v " << std::sin(phi) * std::cos(theta) << ' ' << std::cos(phi) << ' '
+                << std::sin(phi) * std::sin(theta) << '\n';
+        }
+    }
+    out << "v 0 -1 0\n";
+
+    // OBJ indices are 1-based; ring i runs from the top pole's neighbours.
+    auto ring = [&](int i, int j) { return 2 + (i - 1) * slices + j % slices; };
+    auto face = [&](int a, int b, int c) { out << "f " << a << ' ' << (flipped ? c : b) << ' ' << (flipped ? b : c) << '\n'; };
+    int bottom = 2 + (stacks - 1) * slices;
+    for (int j = 0; j < slices; ++j)
+    {
+        face(1, ring(1, j + 1), ring(1, j));
+        for (int i = 1; i + 1 < stacks; ++i)
+        {
+            face(ring(i, j), ring(i, j + 1), ring(i + 1, j + 1));
+            face(ring(i, j), ring(i + 1, j + 1), ring(i + 1, j));
+        }
+        face(bottom, ring(stacks - 1, j), ring(stacks - 1, j + 1));
+    }
+}
+
+// Writes a flat sheet, one triangle and its reverse, at three cell
+// positions on a 2-unit-deep plane seen through projection on a width x
+// height grid with identity model and view matrices.
+void write_sheet_obj(std::ostream &out, const Mat4 &projection, int width, int height, const float (&cells)[3][2])
+{
+    const float depth = 2.0f;
+    for (const auto &cell : cells)
+        out << "v " << (2.0f * cell[0] / width - 1.0f) * depth / projection.m[0] << ' '
+            << (1.0f - 2.0f * cell[1] / height) * depth / projection.m[5] << ' ' << -depth << '\n';
+    out << "f 1 2 3\nf 1 3 2\n";
+}
+
+// Whether two renderers' current grids show the same frame. Blank cells'
+// colours are never presented, so they may differ.
+bool same_frame(const AsciiRenderer &a, const AsciiRenderer &b)
+{
+    if (a.char_buffer != b.char_buffer || a.color_buffer.size() != b.color_buffer.size())
+        return false;
+    for (size_t cell = 0; cell < a.char_buffer.size(); ++cell)
+        if (a.char_buffer[cell] != ' ' && a.color_buffer[cell] != b.color_buffer[cell])
+            return false;
+    return true;
+}
+
+// Checks the fill rule: every layer of a closed convex mesh, from any
+// angle, must cover each cell of its silhouette exactly once, so shared
+// edges leave no cracks and no cell is hit twice. A layer's silhouette is
+// convex, so covered cells must form one unbroken run in every row and
+// column. Both windings of a coarse and a fine sphere are drawn, which
+// exercises the general rasterizer and the single-cell batch. Resized
+// renderers, directly and through a ResolutionController, must then draw
+// the frames a fresh renderer would. Returns whether every frame passed.
+bool run_self_test()
+{
+    // zoom scales the projection; large values push most of the sphere far
+    // off the grid, where big triangles clip down to a few cells.
+    struct Case
+    {
+        int slices, stacks, width, height;
+        float zoom;
+    };
+    const Case cases[] = {{12, 6, 160, 90, 1.0f}, {64, 32, 160, 90, 1.0f}, {240, 120, 60, 30, 1.0f},
+                          {12, 6, 160, 90, 40.0f}, {64, 32, 80, 24, 25.0f}};
+    const int FRAMES = 24;
+    const int MAX_REPORTS = 10;
+
+    std::string path =
+        (std::filesystem::temp_directory_path() / ("ascii_self_test_" + std::to_string(getpid()) + ".obj")).string();
+    int frames = 0, failures = 0;
+    size_t cells_checked = 0;
+    for (const Case &c : cases)
+        for (bool flipped : {false, true})
+        {
+            {
+                std::ofstream out(path);
+                write_sphere_obj(out, c.slices, c.stacks, flipped);
+            }
+            Model model;
+            std::pair<float, float> acmr;
+            std::string error;
+            bool loaded = load_model(path, false, false, &model, &acmr, &error);
+            std::remove(path.c_str());
+            if (!loaded)
+            {
+                std::cerr << error << std::endl;
+                return false;
+            }
+
+            AsciiRenderer renderer(c.width, c.height);
+            renderer.use_lods = false;
+            std::vector<uint16_t> counts(static_cast<size_t>(c.width) * c.height);
+            renderer.coverage_counts = counts.data();
+            TurntableCamera camera = TurntableCamera::fit(model, 60.0f, c.width * CELL_ASPECT / c.height);
+            camera.base.projection_matrix.m[0] *= c.zoom;
+            camera.base.projection_matrix.m[5] *= c.zoom;
+            for (int frame = 0; frame < FRAMES; ++frame, ++frames)
+            {
+                std::fill(counts.begin(), counts.end(), 0);
+                renderer.draw(model, camera.at(0.37f * frame));
+
+                std::string problem;
+                int covered = 0;
+                for (int y = 0; y < c.height && problem.empty(); ++y)
+                    for (int x = 0; x < c.width && problem.empty(); ++x)
+                    {
+                        int count = counts[y * c.width + x];
+                        covered += count > 0;
+                        bool gap_in_row = x > 0 && x + 1 < c.width && count == 0 && counts[y * c.width + x - 1] &&
+                                          std::any_of(counts.begin() + y * c.width + x + 1, counts.begin() + (y + 1) * c.width,
+                                                      [](uint16_t n) { return n > 0; });
+                        bool gap_in_column = false;
+                        if (count == 0 && y > 0 && counts[(y - 1) * c.width + x])
+                            for (int below = y + 1; below < c.height && !gap_in_column; ++below)
+                                gap_in_column = counts[below * c.width + x] > 0;
+                        if (count > 1)
+                            problem = "covered " + std::to_string(count) + " times";
+                        else if (gap_in_row || gap_in_column)
+                            problem = "left uncovered inside the silhouette";
+                        if (!problem.empty())
+                            problem = "cell " + std::to_string(x) + "," + std::to_string(y) + " " + problem;
+                    }
+                if (covered == 0)
+                    problem = "nothing drawn";
+                cells_checked += counts.size();
+                if (problem.empty())
+                    continue;
+                if (++failures <= MAX_REPORTS)
+                    std::cerr << "self-test: sphere " << c.slices << "x" << c.stacks << (flipped ? " flipped" : "")
+                              << " on " << c.width << "x" << c.height << " frame " << frame << ": " << problem
+                              << std::endl;
+            }
+        }
+
+    // Sheets with a corner inside cell (0, 0) and the others up to about
+    // 4000 cells off the top left: each clips to that single cell, which
+    // it must cover exactly once.
+    const int SHEETS = 200;
+    const int sheet_width = 160, sheet_height = 90;
+    FrameView view;
+    view.model_matrix = view.view_matrix = Mat4::identity();
+    view.projection_matrix = Mat4::perspective(60.0f, sheet_width * CELL_ASPECT / sheet_height, 0.1f, 100.0f);
+    view.camera_pos = {0.0f, 0.0f, 0.0f};
+    view.light_direction = Vec3::normalize({0.5f, -1.0f, -1.0f});
+    AsciiRenderer renderer(sheet_width, sheet_height);
+    renderer.use_lods = false;
+    std::vector<uint16_t> counts(static_cast<size_t>(sheet_width) * sheet_height);
+    renderer.coverage_counts = counts.data();
+    for (int sheet = 0; sheet < SHEETS; ++sheet, ++frames)
+    {
+        float reach = 20.0f * (sheet + 1);
+        float corner = 0.75f + 0.5f * (sheet % 11) / 10.0f;
+        float spread = 0.3f * (sheet % 7) / 6.0f;
+        const float cells[3][2] = {
+            {corner, corner}, {corner - reach, corner - reach * spread}, {corner - reach * spread, corner - reach}};
+        {
+            std::ofstream out(path);
+            write_sheet_obj(out, view.projection_matrix, sheet_width, sheet_height, cells);
+        }
+        Model model;
+        std::pair<float, float> acmr;
+        std::string error;
+        bool loaded = load_model(path, false, false, &model, &acmr, &error);
+        std::remove(path.c_str());
+        if (!loaded)
+        {
+            std::cerr << error << std::endl;
+            return false;
+        }
+        std::fill(counts.begin(), counts.end(), 0);
+        renderer.draw(model, view);
+        cells_checked += counts.size();
+        size_t total = 0;
+        for (uint16_t count : counts)
+            total += count;
+        if (counts[0] == 1 && total == 1)
+            continue;
+        if (++failures <= MAX_REPORTS)
+            std::cerr << "self-test: sheet reaching " << reach << " cells off the grid covers cell 0,0 " << counts[0]
+                      << " times and " << total - counts[0] << " other cells" << std::endl;
+    }
+
+    // A resized renderer, drawing several frames at each size so its
+    // swapped grids cycle through the new size, must match a fresh one.
+    {
+        std::ofstream out(path);
+        write_sphere_obj(out, 64, 32, false);
+    }
+    Model sphere;
+    std::pair<float, float> acmr;
+    std::string error;
+    bool loaded = load_model(path, false, false, &sphere, &acmr, &error);
+    std::remove(path.c_str());
+    if (!loaded)
+    {
+        std::cerr << error << std::endl;
+        return false;
+    }
+    const int sizes[][2] = {{40, 20}, {160, 90}, {60, 30}, {100, 50}, {23, 71}};
+    const int FRAMES_PER_SIZE = 4;
+    AsciiRenderer resized(sizes[0][0], sizes[0][1]);
+    resized.use_lods = false;
+    for (const auto &size : sizes)
+    {
+        resized.resize(size[0], size[1]);
+        AsciiRenderer fresh(size[0], size[1]);
+        fresh.use_lods = false;
+        TurntableCamera camera = TurntableCamera::fit(sphere, 60.0f, size[0] * CELL_ASPECT / size[1]);
+        for (int frame = 0; frame < FRAMES_PER_SIZE; ++frame, ++frames)
+        {
+            FrameView view = camera.at(0.37f * frame);
+            resized.draw(sphere, view);
+            fresh.draw(sphere, view);
+            cells_checked += fresh.char_buffer.size();
+            if (same_frame(resized, fresh))
+                continue;
+            if (++failures <= MAX_REPORTS)
+                std::cerr << "self-test: frame " << frame << " after resizing to " << size[0] << "x" << size[1]
+                          << " differs from a fresh renderer's" << std::endl;
+        }
+    }
+
+    // The same through a grid-mode ResolutionController, pipelined like the
+    // interactive loop: fast frames grow the grid past its starting size,
+    // slow ones shrink it below, and each finished frame must match a fresh
+    // renderer's at its size.
+    AsciiRenderer adapted(40, 20);
+    adapted.use_lods = false;
+    ResolutionController controller(ResolutionMode::Grid, 10.0f, adapted, 4.0f);
+    TurntableCamera camera = TurntableCamera::fit(sphere, 60.0f, 40 * CELL_ASPECT / 20);
+    const int ADAPTED_FRAMES = 160;
+    int smallest = adapted.width, largest = adapted.width;
+    FrameView finished_view = camera.at(0.0f);
+    adapted.draw(sphere, finished_view);
+    for (int frame = 1; frame <= ADAPTED_FRAMES; ++frame, ++frames)
+    {
+        FrameView view = camera.at(0.37f * frame);
+        adapted.begin_draw(sphere, view);
+        adapted.finish_draw();
+        AsciiRenderer fresh(adapted.width, adapted.height);
+        fresh.use_lods = false;
+        fresh.draw(sphere, view);
+        cells_checked += fresh.char_buffer.size();
+        if (!same_frame(adapted, fresh) && ++failures <= MAX_REPORTS)
+            std::cerr << "self-test: adapted frame " << frame << " at " << adapted.width << "x" << adapted.height
+                      << " differs from a fresh renderer's" << std::endl;
+        smallest = std::min(smallest, adapted.width);
+        largest = std::max(largest, adapted.width);
+        controller.update(frame <= ADAPTED_FRAMES / 2 ? 2.0 : 40.0, adapted);
+    }
+    if (largest <= 40 || smallest >= 40)
+    {
+        ++failures;
+        std::cerr << "self-test: adapted grid only ranged over widths " << smallest << " to " << largest << std::endl;
+    }
+
+    std::cerr << "self-test: " << frames << " frames, " << cells_checked << " cells, " << failures << " failed"
+              << std::endl;
+    return failures == 0;
+}
+
+// --- Main Application ---
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <path_to_obj_file> <path_to_font_file> [--stats] [--no-sort] [--no-lod] [--no-cache] [--compact] [--threads N] [--pin]\n"
+                  << "           [--temporal N] [--pick] [--render auto|raster|ray]\n"
+                  << "           [--grid WxH] [--font-size N] [--window WxH] [--software] [--target-ms MS [--adapt grid|lod]]\n"
+                  << "       " << argv[0] << " <path_to_obj_file> --turntable FRAMES [--format plain|asciicast|rle] [--out FILE]\n"
+                  << "           [--color none|256|truecolor] [--render auto|raster|ray]\n"
+                  << "       " << argv[0] << " --batch <dir_or_list_file> --out-dir DIR [--turntable FRAMES] [--format ...]\n"
+                  << "       " << argv[0] << " --serve SOCKET [--threads N] [--queue N] [--cache N]\n"
+                  << "       " << argv[0] << " --self-test" << std::endl;
+        return 1;
+    }
+    std::string inputfile;
+    std::string fontfile;
+    bool show_stats = false;
+    bool sort_front_to_back = true;
+    bool use_lods = true;
+    bool cache_faces = true;
+    int temporal_refresh = 0; // Reuse tiles across frames, redrawing in full every N
+    bool pick = false; // Clicking a cell reports the face under it
+    RenderPath render_path = RenderPath::Auto; // Ray casting needs a Bvh, built or loaded on demand
+    bool compact = false;
+    int thread_count = std::max(1u, std::thread::hardware_concurrency());
+    bool pin_threads = false;
+    int turntable_frames = 0;
+    TurntableFormat turntable_format = TurntableFormat::Plain;
+    std::string output_path = "-";
+    std::string batch_source, output_dir;
+    std::string socket_path;
+    int queue_capacity = 64;
+    int cache_capacity = 8;
+    int grid_width = 160, grid_height = 90; // In characters
+    bool grid_given = false;
+    int font_size = 12; // Point size
+    int window_width = 0, window_height = 0; // In pixels; 0 fits the window to the grid
+    float target_frame_ms = 0.0f; // Dynamic resolution when positive
+    ResolutionMode resolution_mode = ResolutionMode::Grid;
+    bool software = false; // Composite glyphs on the CPU
+    ColorMode color_mode = ColorMode::None; // Any mode colours the window in full RGB565
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0 && inputfile.empty())
+            inputfile = arg;
+        else if (arg.compare(0, 2, "--") != 0 && fontfile.empty())
+            fontfile = arg;
+        else if (arg == "--stats")
+            show_stats = true;
+        else if (arg == "--no-sort")
+            sort_front_to_back = false;
+        else if (arg == "--no-lod")
+            use_lods = false;
+        else if (arg == "--no-cache")
+            cache_faces = false;
+        else if (arg == "--temporal" && i + 1 < argc)
+            temporal_refresh = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--pick")
+            pick = true;
+        else if (arg == "--render" && i + 1 < argc)
+        {
+            if (!parse_render_path(argv[++i], &render_path))
+                return 1;
+        }
+        else if (arg == "--compact")
+            compact = true;
+        else if (arg == "--threads" && i + 1 < argc)
+            thread_count = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--pin")
+            pin_threads = true;
+        else if (arg == "--turntable" && i + 1 < argc)
+            turntable_frames = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--format" && i + 1 < argc)
+        {
+            if (!parse_turntable_format(argv[++i], &turntable_format))
+            {
+                std::cerr << "Unknown format: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--color" && i + 1 < argc)
+        {
+            if (!parse_color_mode(argv[++i], &color_mode))
+            {
+                std::cerr << "Unknown color mode: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--out" && i + 1 < argc)
+            output_path = argv[++i];
+        else if (arg == "--batch" && i + 1 < argc)
+            batch_source = argv[++i];
+        else if (arg == "--out-dir" && i + 1 < argc)
+            output_dir = argv[++i];
+        else if (arg == "--serve" && i + 1 < argc)
+            socket_path = argv[++i];
+        else if (arg == "--queue" && i + 1 < argc)
+            queue_capacity = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--cache" && i + 1 < argc)
+            cache_capacity = std::max(1, std::atoi(argv[++i]));
+        else if ((arg == "--grid" || arg == "--window") && i + 1 < argc)
+        {
+            bool grid = arg == "--grid";
+            if (!parse_size(argv[++i], grid ? &grid_width : &window_width, grid ? &grid_height : &window_height))
+            {
+                std::cerr << "Bad size for " << arg << ": " << argv[i] << std::endl;
+                return 1;
+            }
+            grid_given |= grid;
+        }
+        else if (arg == "--software")
+            software = true;
+        else if (arg == "--self-test")
+            return run_self_test() ? 0 : 1;
+        else if (arg == "--font-size" && i + 1 < argc)
+            font_size = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--target-ms" && i + 1 < argc)
+            target_frame_ms = std::max(0.0f, static_cast<float>(std::atof(argv[++i])));
+        else if (arg == "--adapt" && i + 1 < argc)
+        {
+            if (!parse_resolution_mode(argv[++i], &resolution_mode))
+            {
+                std::cerr << "Unknown adapt mode: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    if (!socket_path.empty())
+    {
+        RenderServer server(thread_count, queue_capacity, cache_capacity, use_lods, compact, sort_front_to_back);
+        return server.run(socket_path) ? 0 : 1;
+    }
+    if (!batch_source.empty())
+    {
+        std::vector<std::string> paths;
+        if (!collect_batch_inputs(batch_source, &paths) || paths.empty())
+        {
+            std::cerr << "No models found in " << batch_source << std::endl;
+            return 1;
+        }
+        if (output_dir.empty())
+        {
+            std::cerr << "--batch requires --out-dir" << std::endl;
+            return 1;
+        }
+        return render_batch(paths, output_dir, grid_width, grid_height, std::max(1, turntable_frames),
+                            turntable_format, color_mode, thread_count, pin_threads, use_lods, compact,
+                            sort_front_to_back) ? 0 : 1;
+    }
+    if (inputfile.empty())
+    {
+        std::cerr << "No model given" << std::endl;
+        return 1;
+    }
+
+    // 1. Load OBJ Model
+    Model model;
+    std::pair<float, float> acmr;
+    std::string error;
+    if (!load_model(inputfile, use_lods, compact, &model, &acmr, &error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    if (show_stats)
+        std::cerr << "vertices " << (model.compact() ? model.quantized.size() : model.positions.size())
+                  << " ACMR (FIFO 16) " << acmr.first << " -> " << acmr.second << " mesh bytes " << model_bytes(model)
+                  << std::endl;
+
+    Bvh bvh;
+    if (pick || render_path != RenderPath::Raster)
+    {
+        auto bvh_start = std::chrono::steady_clock::now();
+        bool cached;
+        load_bvh(inputfile, model, &bvh, &cached);
+        if (show_stats)
+            std::cerr << "bvh faces " << bvh.faces.size() << " nodes " << bvh.nodes.size() << " bytes " << bvh.bytes()
+                      << (cached ? " loaded in " : " built in ")
+                      << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - bvh_start).count()
+                      << "ms" << std::endl;
+    }
+
+    const Bvh *ray_bvh = bvh.empty() ? nullptr : &bvh;
+
+    if (turntable_frames > 0)
+    {
+        std::ofstream file;
+        if (output_path != "-")
+        {
+            file.open(output_path, std::ios::binary);
+            if (!file)
+            {
+                std::cerr << "Failed to open " << output_path << std::endl;
+                return 1;
+            }
+        }
+        std::ostream &out = output_path == "-" ? std::cout : file;
+        return render_turntable(model, grid_width, grid_height, turntable_frames, turntable_format, color_mode, out,
+                                thread_count, use_lods, sort_front_to_back, ray_bvh, render_path) ? 0 : 1;
+    }
+    if (fontfile.empty())
+    {
+        std::cerr << "A font file is required for interactive mode" << std::endl;
+        return 1;
+    }
+
+    // 2. Initialize SDL and SDL_ttf
+    if (SDL_Init(SDL_INIT_VIDEO) < 0)
+    {
+        std::cerr << "SDL could not initialize! SDL_Error: " << SDL_GetError() << std::endl;
+        return 1;
+    }
+    if (TTF_Init() == -1)
+    {
+        std::cerr << "SDL_ttf could not initialize! TTF_Error: " << TTF_GetError() << std::endl;
+        SDL_Quit();
+        return 1;
+    }
+
+    int font_width, font_height;
+
+    TTF_Font *font = TTF_OpenFont(fontfile.c_str(), font_size);
+    if (!font)
+    {
+        std::cerr << "Failed to load font: " << TTF_GetError() << std::endl;
+        TTF_Quit();
+        SDL_Quit();
+        return 1;
+    }
+    TTF_SizeText(font, " ", &font_width, &font_height); // Get character dimensions
+
+    // The window defaults to the grid at the font's size; a window given
+    // without a grid gets as many cells as fit. Otherwise glyphs are scaled
+    // to fill the window's cells.
+    if (window_width == 0)
+    {
+        window_width = grid_width * font_width;
+        window_height = grid_height * font_height;
+    }
+    else if (!grid_given)
+    {
+        grid_width = std::max(1, window_width / font_width);
+        grid_height = std::max(1, window_height / font_height);
+    }
+
+    SDL_Window *window = SDL_CreateWindow("ASCII Renderer", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, window_width, window_height, SDL_WINDOW_SHOWN);
+    SDL_Renderer *renderer = software ? nullptr : SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    if (window && !renderer)
+    {
+        // Headless hosts often have no accelerated renderer; glyphs are then
+        // composited on the CPU and uploaded as one texture per frame.
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+        software = true;
+    }
+    if (!window || !renderer)
+    {
+        std::cerr << "Window or Renderer could not be created! SDL_Error: " << SDL_GetError() << std::endl;
+        TTF_CloseFont(font);
+        TTF_Quit();
+        SDL_Quit();
+        return 1;
+    }
+
+    // Pre-render ASCII characters once into an alpha atlas. The CPU
+    // compositor reads it directly; otherwise it is uploaded as a single
+    // white texture and each frame's glyphs are drawn in one batched call,
+    // tinted through their vertex colours.
+    GlyphAtlas atlas(font_width, font_height);
+    GlyphCompositor compositor(atlas);
+    SDL_Texture *frame_texture = nullptr;
+    SDL_Texture *atlas_texture = nullptr;
+    SDL_Color text_color = {255, 255, 255, 255}; // White
+    const std::string ascii_chars = DEFAULT_RAMP;
+    for (char c : ascii_chars)
+    {
+        std::string s(1, c);
+        SDL_Surface *text_surface = TTF_RenderText_Blended(font, s.c_str(), text_color);
+        SDL_Surface *argb =
+            text_surface ? SDL_ConvertSurfaceFormat(text_surface, SDL_PIXELFORMAT_ARGB8888, 0) : nullptr;
+        if (argb && SDL_LockSurface(argb) == 0)
+        {
+            atlas.add(c, static_cast<const uint32_t *>(argb->pixels), argb->pitch, argb->w, argb->h, 0xFFFFFFFFu);
+            SDL_UnlockSurface(argb);
+        }
+        SDL_FreeSurface(argb);
+        SDL_FreeSurface(text_surface);
+    }
+    // Tiles are stacked vertically, so the atlas's alpha is already in
+    // texture row order.
+    int atlas_tiles = static_cast<int>(atlas.alpha.size() / (font_width * font_height));
+    if (!software && atlas_tiles > 0)
+    {
+        std::vector<uint32_t> atlas_pixels(atlas.alpha.size());
+        for (size_t i = 0; i < atlas.alpha.size(); ++i)
+            atlas_pixels[i] = static_cast<uint32_t>(atlas.alpha[i]) << 24 | 0x00FFFFFFu;
+        atlas_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, font_width,
+                                          font_height * atlas_tiles);
+        if (atlas_texture)
+        {
+            SDL_UpdateTexture(atlas_texture, NULL, atlas_pixels.data(), font_width * 4);
+            SDL_SetTextureBlendMode(atlas_texture, SDL_BLENDMODE_BLEND);
+        }
+    }
+    std::vector<SDL_Vertex> glyph_vertices;
+    std::vector<int> glyph_indices;
+
+    // 3. Main Loop
+    bool quit = false;
+    SDL_Event e;
+    float rotation_angle_y = 0.0f;
+
+    AsciiRenderer ascii(grid_width, grid_height, thread_count, pin_threads);
+    ascii.sort_front_to_back = sort_front_to_back;
+    ascii.use_lods = use_lods;
+    ascii.cache_faces = cache_faces;
+    ascii.temporal_refresh = temporal_refresh;
+    ascii.render_path = render_path;
+
+    // Frames after the first few must not allocate; see FrameArena. Each of
+    // the renderer's two frame arenas needs a couple of frames to settle.
+    const int WARMUP_FRAMES = 4;
+    int frame_index = 0;
+
+    // Dynamic resolution: the grid may grow to as many cells as the window
+    // holds at the font's own size.
+    ResolutionController resolution(resolution_mode, target_frame_ms, ascii,
+                                    std::min(static_cast<float>(window_width / font_width) / grid_width,
+                                             static_cast<float>(window_height / font_height) / grid_height));
+
+    Vec3 camera_pos = {0.0f, 2.0f, -5.0f};
+    Vec3 look_at = {0.0f, 0.0f, 0.0f};
+    Vec3 up_vec = {0.0f, 1.0f, 0.0f};
+    Vec3 light_direction = Vec3::normalize({0.5f, -1.0f, -1.0f});
+
+    // 4. Setup Matrices
+    auto next_view = [&]() {
+        FrameView view;
+        view.model_matrix = Mat4::create_rotation_y(rotation_angle_y);
+        // As for TurntableCamera, the camera spins opposite to the model.
+        Vec4 eye = Mat4::create_rotation_y(-rotation_angle_y).transform({camera_pos.x, camera_pos.y, camera_pos.z, 1.0f});
+        rotation_angle_y += 0.01f;
+        view.view_matrix = Mat4::lookAt(camera_pos, look_at, up_vec);
+        view.projection_matrix = Mat4::perspective(90.0f, (float)window_width / window_height, 0.1f, 100.0f);
+        view.camera_pos = {eye.x, eye.y, eye.z};
+        view.light_direction = light_direction;
+        return view;
+    };
+
+    // 5. Render Loop
+    // Pipelined: the worker threads draw frame N+1 while the main thread,
+    // which SDL requires for presentation, presents frame N.
+    // Picks resolve against the frame on screen, which is one behind the
+    // finished frame.
+    FrameView finished_view = next_view(), presented_view = finished_view;
+    int presented_width = grid_width, presented_height = grid_height;
+    ascii.draw(model, finished_view, ray_bvh);
+    while (!quit)
+    {
+        while (SDL_PollEvent(&e) != 0)
+        {
+            if (e.type == SDL_QUIT)
+                quit = true;
+            else if (pick && e.type == SDL_MOUSEBUTTONDOWN)
+                print_pick(bvh, model, presented_view, presented_width, presented_height,
+                           e.button.x * presented_width / window_width, e.button.y * presented_height / window_height);
+        }
+
+        size_t allocations_before = heap_allocation_count();
+
+        FrameView view = next_view();
+        ascii.begin_draw(model, view, ray_bvh);
+
+        auto present_start = std::chrono::steady_clock::now();
+        SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xFF);
+        SDL_RenderClear(renderer);
+
+        if (show_stats)
+        {
+            print_stats(ascii.finished_stats());
+            if (target_frame_ms > 0.0f)
+                print_stats(resolution, ascii);
+        }
+
+        // Render the finished frame's glyphs to the screen, scaled so its
+        // grid fills the window whatever its size
+        if (software)
+        {
+            if (compositor.resize(ascii.finished_width(), ascii.finished_height()))
+            {
+                if (frame_texture)
+                    SDL_DestroyTexture(frame_texture);
+                frame_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                                  compositor.width(), compositor.height());
+            }
+            compositor.compose(ascii.finished_char_buffer().data(),
+                               color_mode != ColorMode::None ? ascii.finished_color_buffer().data() : nullptr);
+            SDL_UpdateTexture(frame_texture, NULL, compositor.pixels(), compositor.pitch());
+            SDL_RenderCopy(renderer, frame_texture, NULL, NULL);
+        }
+        else if (atlas_texture)
+        {
+            {
+                AllocationTracking tracking; // SDL's own allocations below aren't ours to check
+                // Sized for a full grid so covering more cells never allocates;
+                // only a larger grid does, inside its warm-up.
+                size_t cells = static_cast<size_t>(ascii.finished_width()) * ascii.finished_height();
+                glyph_vertices.reserve(cells * 4);
+                glyph_indices.reserve(cells * 6);
+                glyph_vertices.clear();
+                glyph_indices.clear();
+                float cell_width = static_cast<float>(window_width) / ascii.finished_width();
+                float cell_height = static_cast<float>(window_height) / ascii.finished_height();
+                float tile_v = 1.0f / atlas_tiles;
+                ascii.for_each_glyph([&](int x, int y, char c, uint16_t color) {
+                    int tile = atlas.tile[static_cast<unsigned char>(c)];
+                    if (tile < 0)
+                        return;
+                    SDL_Color tint = text_color;
+                    if (color_mode != ColorMode::None)
+                        unpack_rgb565(color, &tint.r, &tint.g, &tint.b);
+                    float x0 = std::floor(x * cell_width), x1 = std::floor((x + 1) * cell_width);
+                    float y0 = std::floor(y * cell_height), y1 = std::floor((y + 1) * cell_height);
+                    float v0 = tile * tile_v, v1 = v0 + tile_v;
+                    int base = static_cast<int>(glyph_vertices.size());
+                    glyph_vertices.push_back({{x0, y0}, tint, {0.0f, v0}});
+                    glyph_vertices.push_back({{x1, y0}, tint, {1.0f, v0}});
+                    glyph_vertices.push_back({{x0, y1}, tint, {0.0f, v1}});
+                    glyph_vertices.push_back({{x1, y1}, tint, {1.0f, v1}});
+                    for (int corner : {0, 1, 2, 2, 1, 3})
+                        glyph_indices.push_back(base + corner);
+                });
+            }
+            SDL_RenderGeometry(renderer, atlas_texture, glyph_vertices.data(), static_cast<int>(glyph_vertices.size()),
+                               glyph_indices.data(), static_cast<int>(glyph_indices.size()));
+        }
+
+        SDL_RenderPresent(renderer);
+        presented_view = finished_view;
+        presented_width = ascii.finished_width();
+        presented_height = ascii.finished_height();
+        double present_ms =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - present_start).count();
+        SDL_Delay(10);
+
+        ascii.finish_draw();
+        finished_view = view;
+
+        // Drawing and presenting overlap, so the slower of the two sets the
+        // frame rate.
+        // A new grid or LOD bias changes the frame's arena needs, so it
+        // gets its own warm-up.
+        if (target_frame_ms > 0.0f &&
+            resolution.update(std::max(ascii.finished_stats().render_ms, present_ms), ascii))
+            frame_index = 0;
+
+        if (++frame_index > WARMUP_FRAMES)
+            assert(heap_allocation_count() == allocations_before && "steady-state frame allocated");
+        (void)allocations_before;
+    }
+
+    // 6. Cleanup
+    if (atlas_texture)
+        SDL_DestroyTexture(atlas_texture);
+    if (frame_texture)
+        SDL_DestroyTexture(frame_texture);
     TTF_CloseFont(font);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
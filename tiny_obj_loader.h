@@ -878,6 +878,102 @@ static inline int parseInt(const char **token) {
   return i;
 }
 
+// Returns true if all eight bytes of `chunk` (little-endian) are ASCII digits.
+static inline bool isEightDigits(unsigned long long chunk) {
+  return ((chunk & 0xF0F0F0F0F0F0F0F0ULL) |
+          (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+         0x3333333333333333ULL;
+}
+
+// Converts eight ASCII digits (little-endian) to their value with three
+// multiplies instead of eight.
+static inline unsigned long long parseEightDigits(unsigned long long chunk) {
+  chunk = ((chunk & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+  chunk = ((chunk & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+  return ((chunk & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+}
+
+// Four-digit variants of the above for the tail of a fraction.
+static inline bool isFourDigits(unsigned int chunk) {
+  return ((chunk & 0xF0F0F0F0U) |
+          (((chunk + 0x06060606U) & 0xF0F0F0F0U) >> 4)) == 0x33333333U;
+}
+
+static inline unsigned int parseFourDigits(unsigned int chunk) {
+  chunk = ((chunk & 0x0F0F0F0FU) * 2561) >> 8;
+  return (((chunk & 0x00FF00FFU) * 6553601) >> 16) & 0xFFFFU;
+}
+
+// Fast path for the plain decimals that make up nearly every OBJ number:
+//   [sign] digit {digit} ["." digit {digit}]
+// with at most 19 digits and no exponent. The digits are accumulated
+// exactly in a 64-bit integer, eight and then four at a time where
+// possible; if that integer fits in a double's 53-bit significand and the
+// power of ten is at most 10^22, a single division gives the correctly
+// rounded result (Clinger's fast path). Anything else returns false and is
+// left to the general parser below.
+static inline bool tryParseDecimalFast(const char *s, const char *s_end,
+                                       double *result) {
+  static const double pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                 1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                 1e18, 1e19, 1e20, 1e21, 1e22};
+  const char *curr = s;
+  bool negative = false;
+  if (curr != s_end && (*curr == '+' || *curr == '-')) {
+    negative = (*curr == '-');
+    curr++;
+  }
+
+  unsigned long long mantissa = 0;
+  const char *int_begin = curr;
+  while (curr != s_end && IS_DIGIT(*curr)) {
+    mantissa = mantissa * 10 + static_cast<unsigned>(*curr - '0');
+    curr++;
+  }
+  long int_digits = curr - int_begin;
+  if (int_digits == 0) return false;
+
+  long frac_digits = 0;
+  if (curr != s_end && *curr == '.') {
+    curr++;
+    const char *frac_begin = curr;
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    while (s_end - curr >= 8) {
+      unsigned long long chunk;
+      memcpy(&chunk, curr, 8);
+      if (!isEightDigits(chunk)) break;
+      mantissa = mantissa * 100000000ULL + parseEightDigits(chunk);
+      curr += 8;
+    }
+    if (s_end - curr >= 4) {
+      unsigned int chunk;
+      memcpy(&chunk, curr, 4);
+      if (isFourDigits(chunk)) {
+        mantissa = mantissa * 10000 + parseFourDigits(chunk);
+        curr += 4;
+      }
+    }
+#endif
+    while (curr != s_end && IS_DIGIT(*curr)) {
+      mantissa = mantissa * 10 + static_cast<unsigned>(*curr - '0');
+      curr++;
+    }
+    frac_digits = curr - frac_begin;
+    if (frac_digits == 0) return false;
+  }
+  if (curr != s_end && (*curr == 'e' || *curr == 'E')) return false;
+
+  // More than 19 digits may have wrapped the accumulator.
+  if (int_digits + frac_digits > 19 || frac_digits > 22 ||
+      mantissa > (1ULL << 53)) {
+    return false;
+  }
+  double value = static_cast<double>(mantissa) / pow10[frac_digits];
+  *result = negative ? -value : value;
+  return true;
+}
+
 // Tries to parse a floating point number located at s.
 //
 // s_end should be a location in the string where reading should absolutely
@@ -910,6 +1006,10 @@ static bool tryParseDouble(const char *s, const char *s_end, double *result) {
     return false;
   }
 
+  if (tryParseDecimalFast(s, s_end, result)) {
+    return true;
+  }
+
   double mantissa = 0.0;
   // This exponent is base 2 rather than 10.
   // However the exponent we parse is supposed to be one of ten,